@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/udp.h>
+
+#include "batch.h"
+#include "safeUtil.h"
+
+// Allocates space for up to batch_size messages
+void batch_create(struct batch *input_batch, int batch_size) {
+    input_batch->count = 0;
+    input_batch->size = batch_size;
+    input_batch->iov_count = 0;
+    input_batch->gso_size = 0;
+    input_batch->gso_open = 0;
+    input_batch->gso_segments = 0;
+    input_batch->msgs = sCalloc(batch_size, sizeof(struct mmsghdr));
+    input_batch->iovs = sCalloc((size_t)batch_size * BATCH_MAX_IOV, sizeof(struct iovec));
+    input_batch->control = NULL;
+    input_batch->slots = NULL;
+    input_batch->addrs = NULL;
+    input_batch->segment_len = NULL;
+}
+
+// Queue a PDU (not copied, must stay valid until send_batch)
+void batch_add(struct batch *input_batch, uint8_t *packet, int32_t packet_len, struct Connection *connection) {
+    struct iovec iov = {packet, packet_len};
+
+    batch_addv(input_batch, &iov, 1, connection);
+}
+
+// Queue a PDU gathered from iov_count pieces (the pieces aren't copied either)
+void batch_addv(struct batch *input_batch, struct iovec *iov, int iov_count, struct Connection *connection) {
+    if ((input_batch->count == input_batch->size) || (input_batch->iov_count + iov_count > input_batch->size * BATCH_MAX_IOV)) {
+        send_batch(input_batch, connection); // Full, push what we have
+    }
+
+    int index = input_batch->count;
+    struct msghdr *hdr = &input_batch->msgs[index].msg_hdr;
+
+    memset(hdr, 0, sizeof(struct msghdr));
+    hdr->msg_name = &connection->address;
+    hdr->msg_namelen = sizeof(connection->address);
+    hdr->msg_iov = &input_batch->iovs[input_batch->iov_count];
+    hdr->msg_iovlen = iov_count;
+
+    memcpy(hdr->msg_iov, iov, iov_count * sizeof(struct iovec));
+
+    input_batch->count++;
+    input_batch->iov_count += iov_count;
+    input_batch->gso_open = 0;
+    input_batch->gso_segments = 1;
+}
+
+// Turns on UDP_SEGMENT offload for PDUs of gso_size bytes, returns 0 if the kernel can't
+int batch_enable_gso(struct batch *input_batch, int socket_num, int gso_size) {
+    int current = 0;
+    socklen_t current_len = sizeof(current);
+
+    // Jumbo PDUs can't share a super-datagram, the kernel rejects them as a GSO send
+    if (2 * gso_size > MAX_GSO_BYTES) {
+        return 0;
+    }
+
+    // Kernels without UDP GSO (< 4.18) don't know the option
+    if (getsockopt(socket_num, SOL_UDP, UDP_SEGMENT, &current, &current_len) < 0) {
+        perror("UDP_SEGMENT not supported, sending per packet");
+        return 0;
+    }
+
+    input_batch->gso_size = gso_size;
+    input_batch->control = sCalloc(input_batch->size, CMSG_SPACE(sizeof(uint16_t)));
+
+    return 1;
+}
+
+// Queue a full-size PDU, riding on the previous GSO message when it has room
+void batch_add_segment(struct batch *input_batch, uint8_t *packet, int32_t packet_len, struct Connection *connection) {
+    struct iovec iov = {packet, packet_len};
+
+    batch_add_segmentv(input_batch, &iov, 1, connection);
+}
+
+// batch_add_segment for a PDU gathered from iov_count pieces
+void batch_add_segmentv(struct batch *input_batch, struct iovec *iov, int iov_count, struct Connection *connection) {
+    int32_t packet_len = 0;
+
+    for (int i = 0; i < iov_count; i++) {
+        packet_len += iov[i].iov_len;
+    }
+
+    if ((input_batch->gso_size != packet_len) || (input_batch->iov_count + iov_count > input_batch->size * BATCH_MAX_IOV)) {
+        batch_addv(input_batch, iov, iov_count, connection);
+        input_batch->gso_open = (input_batch->gso_size == packet_len);
+        return;
+    }
+
+    if (!input_batch->gso_open) {
+        batch_addv(input_batch, iov, iov_count, connection);
+        input_batch->gso_open = 1;
+        return;
+    }
+
+    // The last message's iovs end at iov_count, so the new segment extends it
+    int index = input_batch->count - 1;
+    struct msghdr *hdr = &input_batch->msgs[index].msg_hdr;
+
+    memcpy(&input_batch->iovs[input_batch->iov_count], iov, iov_count * sizeof(struct iovec));
+    hdr->msg_iovlen += iov_count;
+    input_batch->iov_count += iov_count;
+    input_batch->gso_segments++;
+
+    // The kernel cuts the super-datagram back into gso_size PDUs
+    if (input_batch->gso_segments == 2) {
+        uint16_t gso_size = input_batch->gso_size;
+        uint8_t *control = input_batch->control + (size_t)index * CMSG_SPACE(sizeof(uint16_t));
+
+        hdr->msg_control = control;
+        hdr->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+    }
+
+    // Close the message at the segment limits
+    if ((input_batch->gso_segments == MAX_GSO_SEGMENTS) || ((input_batch->gso_segments + 1) * input_batch->gso_size > MAX_GSO_BYTES)) {
+        input_batch->gso_open = 0;
+    }
+}
+
+// Sends one PDU gathered from iov_count pieces, through sendmmsg() so it gets the same treatment as a batch
+int send_gather(struct iovec *iov, int iov_count, struct Connection *connection) {
+    struct mmsghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_hdr.msg_name = &connection->address;
+    msg.msg_hdr.msg_namelen = sizeof(connection->address);
+    msg.msg_hdr.msg_iov = iov;
+    msg.msg_hdr.msg_iovlen = iov_count;
+
+    return safeSendmmsg(connection->sk_num, &msg, 1, 0);
+}
+
+// Sends every queued PDU and empties the batch
+int send_batch(struct batch *input_batch, struct Connection *connection) {
+    int sent = 0;
+
+    if (input_batch->count > 0) {
+        sent = safeSendmmsg(connection->sk_num, input_batch->msgs, input_batch->count, 0);
+    }
+
+    input_batch->count = 0;
+    input_batch->iov_count = 0;
+    input_batch->gso_open = 0;
+    return sent;
+}
+
+// Allocates batch_size receive slots of slot_len bytes each
+void batch_create_recv(struct batch *input_batch, int batch_size, int slot_len) {
+    if (batch_size > MAX_BATCH) {
+        batch_size = MAX_BATCH;
+    }
+
+    batch_create(input_batch, batch_size);
+    input_batch->next = 0;
+    input_batch->next_offset = 0;
+    input_batch->slot_len = slot_len;
+    input_batch->slots = sCalloc(batch_size, slot_len);
+    input_batch->addrs = sCalloc(batch_size, sizeof(struct sockaddr_in6));
+    input_batch->segment_len = sCalloc(batch_size, sizeof(int));
+
+    for (int i = 0; i < batch_size; i++) {
+        input_batch->iovs[i].iov_base = input_batch->slots + (size_t)i * slot_len;
+        input_batch->iovs[i].iov_len = slot_len;
+    }
+}
+
+// Drains up to size queued datagrams with one recvmmsg() (does not block)
+int recv_batch(struct batch *input_batch, struct Connection *connection) {
+    for (int i = 0; i < input_batch->size; i++) {
+        struct msghdr *hdr = &input_batch->msgs[i].msg_hdr;
+
+        memset(hdr, 0, sizeof(struct msghdr));
+        hdr->msg_name = &input_batch->addrs[i];
+        hdr->msg_namelen = sizeof(struct sockaddr_in6);
+        hdr->msg_iov = &input_batch->iovs[i];
+        hdr->msg_iovlen = 1;
+
+        if (input_batch->control != NULL) {
+            hdr->msg_control = input_batch->control + (size_t)i * CMSG_SPACE(sizeof(int));
+            hdr->msg_controllen = CMSG_SPACE(sizeof(int));
+        }
+    }
+
+    input_batch->count = safeRecvmmsg(connection->sk_num, input_batch->msgs, input_batch->size, MSG_DONTWAIT);
+    input_batch->next = 0;
+    input_batch->next_offset = 0;
+
+    // Coalesced buffers report the size the sender's segments had
+    for (int i = 0; i < input_batch->count; i++) {
+        struct msghdr *hdr = &input_batch->msgs[i].msg_hdr;
+        input_batch->segment_len[i] = 0;
+
+        if (input_batch->control == NULL) {
+            continue;
+        }
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+            if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO)) {
+                memcpy(&input_batch->segment_len[i], CMSG_DATA(cmsg), sizeof(int));
+            }
+        }
+    }
+
+    // Replies go back to whoever sent the most recent datagram (same as recv_buf)
+    if (input_batch->count > 0) {
+        memcpy(&connection->address, &input_batch->addrs[input_batch->count - 1], sizeof(struct sockaddr_in6));
+    }
+
+    return input_batch->count;
+}
+
+// Returns received message index and its length
+uint8_t* batch_get(struct batch *input_batch, int index, int32_t *packet_len) {
+    *packet_len = input_batch->msgs[index].msg_len;
+    return input_batch->iovs[index].iov_base;
+}
+
+// Turns on UDP_GRO for the socket, returns 0 if the kernel can't
+int batch_enable_gro(struct batch *input_batch, int socket_num) {
+    int on = 1;
+
+    if (setsockopt(socket_num, SOL_UDP, UDP_GRO, &on, sizeof(on)) < 0) {
+        perror("UDP_GRO not supported, receiving per packet");
+        return 0;
+    }
+
+    if (input_batch->control == NULL) {
+        input_batch->control = sCalloc(input_batch->size, CMSG_SPACE(sizeof(int)));
+    }
+
+    return 1;
+}
+
+// Hands out the next received PDU, splitting GRO buffers, NULL once drained
+uint8_t* batch_next(struct batch *input_batch, int32_t *packet_len) {
+    if (input_batch->next >= input_batch->count) {
+        return NULL;
+    }
+
+    int index = input_batch->next;
+    int32_t msg_len = input_batch->msgs[index].msg_len;
+    int32_t segment_len = input_batch->segment_len[index];
+    uint8_t *packet = (uint8_t *)input_batch->iovs[index].iov_base + input_batch->next_offset;
+
+    // Plain datagram, or the last (possibly short) segment of a GRO buffer
+    if ((segment_len <= 0) || (input_batch->next_offset + segment_len >= msg_len)) {
+        *packet_len = msg_len - input_batch->next_offset;
+        input_batch->next++;
+        input_batch->next_offset = 0;
+    }
+    else {
+        *packet_len = segment_len;
+        input_batch->next_offset += segment_len;
+    }
+
+    return packet;
+}
+
+// Gives back what batch_create/batch_create_recv and the GSO/GRO cmsgs allocated
+void batch_free(struct batch *input_batch) {
+    free(input_batch->msgs);
+    free(input_batch->iovs);
+    free(input_batch->control);
+    free(input_batch->slots);
+    free(input_batch->addrs);
+    free(input_batch->segment_len);
+    memset(input_batch, 0, sizeof(struct batch));
+}
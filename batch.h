@@ -0,0 +1,77 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "networks.h"
+
+#define MAX_BATCH 1024 // Kernel caps one sendmmsg()/recvmmsg() at UIO_MAXIOV
+#define MAX_GSO_SEGMENTS 64 // UDP_MAX_SEGMENTS
+#define MAX_GSO_BYTES 65507 // Largest UDP payload one super-datagram may carry
+#define MAX_GRO_BATCH 64 // GRO slots are 64KB each, keep the batch bounded
+#define GRO_SLOT_LEN 65535 // Room for one coalesced GRO buffer
+#define BATCH_MAX_IOV 2 // Pieces one PDU may be gathered from (header + mapped payload)
+
+// Vector of PDUs handed to the kernel with a single sendmmsg()/recvmmsg()
+struct batch {
+    int count; // Messages queued (send) or received (recv)
+    int next; // Next received message to hand out
+    int next_offset; // Next segment within a coalesced GRO message
+    int size; // Capacity of msgs/iovs
+    int slot_len; // Bytes per receive slot
+    int iov_count; // iovs in use (a GSO message spans several)
+    int gso_size; // UDP_SEGMENT size for coalescing full PDUs (0 = off)
+    int gso_open; // Last message can still take another segment
+    int gso_segments; // PDUs in the last message
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    uint8_t *control; // One UDP_SEGMENT (send) or UDP_GRO (recv) cmsg per message
+    uint8_t *slots; // Preallocated receive buffers (size * slot_len)
+    struct sockaddr_in6 *addrs; // Source address of each received message
+    int *segment_len; // GRO segment size of each received message (0 = one PDU)
+};
+
+// Allocates space for up to batch_size messages
+void batch_create(struct batch *input_batch, int batch_size);
+
+// Queue a PDU (not copied, must stay valid until send_batch)
+void batch_add(struct batch *input_batch, uint8_t *packet, int32_t packet_len, struct Connection *connection);
+
+// Queue a PDU gathered from iov_count pieces (the pieces aren't copied either)
+void batch_addv(struct batch *input_batch, struct iovec *iov, int iov_count, struct Connection *connection);
+
+// Turns on UDP_SEGMENT offload for PDUs of gso_size bytes, returns 0 if the kernel can't or two don't fit
+int batch_enable_gso(struct batch *input_batch, int socket_num, int gso_size);
+
+// Queue a full-size PDU, riding on the previous GSO message when it has room
+void batch_add_segment(struct batch *input_batch, uint8_t *packet, int32_t packet_len, struct Connection *connection);
+
+// batch_add_segment for a PDU gathered from iov_count pieces
+void batch_add_segmentv(struct batch *input_batch, struct iovec *iov, int iov_count, struct Connection *connection);
+
+// Sends one PDU gathered from iov_count pieces, through sendmmsg() so it gets the same treatment as a batch
+int send_gather(struct iovec *iov, int iov_count, struct Connection *connection);
+
+// Sends every queued PDU and empties the batch
+int send_batch(struct batch *input_batch, struct Connection *connection);
+
+// Allocates batch_size receive slots of slot_len bytes each
+void batch_create_recv(struct batch *input_batch, int batch_size, int slot_len);
+
+// Drains up to size queued datagrams with one recvmmsg() (does not block)
+int recv_batch(struct batch *input_batch, struct Connection *connection);
+
+// Returns received message index and its length
+uint8_t* batch_get(struct batch *input_batch, int index, int32_t *packet_len);
+
+// Turns on UDP_GRO for the socket, returns 0 if the kernel can't
+int batch_enable_gro(struct batch *input_batch, int socket_num);
+
+// Hands out the next received PDU, splitting GRO buffers, NULL once drained
+uint8_t* batch_next(struct batch *input_batch, int32_t *packet_len);
+
+// Gives back what batch_create/batch_create_recv and the GSO/GRO cmsgs allocated
+void batch_free(struct batch *input_batch);
+
+#endif // BATCH_H
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+#include "compress.h"
+
+#define COMPRESS_WINDOW_BITS -15 // Negative: raw deflate, no zlib header or trailer on every PDU
+
+// Server side: rcopy's INIT_OPT_COMPRESS asked for level, chunks are up to buf_size. -1 if it can't
+int compress_init(struct compressor *c, int level, int32_t buf_size) {
+    memset(c, 0, sizeof(struct compressor));
+
+    if ((level < Z_BEST_SPEED) || (level > Z_BEST_COMPRESSION) || (buf_size <= 0)) {
+        return -1;
+    }
+
+    if (deflateInit2(&c->zs, level, Z_DEFLATED, COMPRESS_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+
+    c->out = (uint8_t *) malloc(buf_size);
+    if (c->out == NULL) {
+        deflateEnd(&c->zs);
+        return -1;
+    }
+
+    c->backoff = 1;
+    c->active = 1;
+    return 0;
+}
+
+// Server side: compressed length of the chunk (*out points at it), 0 if it goes raw.
+// Output stops one byte short of the chunk, so an incompressible one costs a partial pass at most
+int32_t compress_chunk(struct compressor *c, uint8_t *chunk, int32_t len, uint8_t **out) {
+    if (!c->active || (len < 2)) {
+        return 0;
+    }
+
+    // Already compressed data stays that way, only probe it now and then
+    if (c->skip > 0) {
+        c->skip--;
+        return 0;
+    }
+
+    deflateReset(&c->zs);
+    c->zs.next_in = chunk;
+    c->zs.avail_in = len;
+    c->zs.next_out = c->out;
+    c->zs.avail_out = len - 1;
+
+    if (deflate(&c->zs, Z_FINISH) != Z_STREAM_END) {
+        c->skip = c->backoff;
+        if (c->backoff < COMPRESS_MAX_SKIP) {
+            c->backoff *= 2;
+        }
+        return 0;
+    }
+
+    c->backoff = 1;
+    *out = c->out;
+    return (int32_t)c->zs.total_out;
+}
+
+// Server side: ends the deflate stream
+void compress_free(struct compressor *c) {
+    if (c->active) {
+        deflateEnd(&c->zs);
+    }
+    free(c->out);
+    c->out = NULL;
+    c->active = 0;
+}
+
+// rcopy side: -1 if zlib can't be set up
+int decompress_init(struct decompressor *d) {
+    memset(d, 0, sizeof(struct decompressor));
+
+    if (inflateInit2(&d->zs, COMPRESS_WINDOW_BITS) != Z_OK) {
+        return -1;
+    }
+
+    d->active = 1;
+    return 0;
+}
+
+// rcopy side: inflates one payload into out (out_len bytes at most), returns the chunk length, -1 on a bad stream
+int32_t decompress_chunk(struct decompressor *d, uint8_t *data, int32_t len, uint8_t *out, int32_t out_len) {
+    inflateReset(&d->zs);
+    d->zs.next_in = data;
+    d->zs.avail_in = len;
+    d->zs.next_out = out;
+    d->zs.avail_out = out_len;
+
+    // The whole stream has to be in this payload and fit one chunk
+    if ((inflate(&d->zs, Z_FINISH) != Z_STREAM_END) || (d->zs.avail_in != 0)) {
+        return -1;
+    }
+
+    d->wire_bytes += len;
+    d->chunk_bytes += d->zs.total_out;
+    return (int32_t)d->zs.total_out;
+}
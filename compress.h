@@ -0,0 +1,42 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdint.h>
+#include <zlib.h>
+
+#define COMPRESS_LEVEL 1 // Level rcopy asks for: fastest deflate, a chunk has to be ready as soon as the window opens
+#define COMPRESS_MAX_SKIP 64 // Most chunks sent raw without trying, after a run that didn't shrink
+
+// Server side: deflates every chunk on its own, so a lost PDU never holds up the ones behind it
+struct compressor {
+    int active; // Negotiated, DATA payloads that shrink go out compressed
+    z_stream zs; // Raw deflate, reset per chunk
+    uint8_t *out; // Compressed chunk
+    int skip; // Chunks still to send raw before trying again
+    int backoff; // Next skip after a chunk that didn't shrink
+};
+
+// rcopy side: inflates compressed payloads back into chunks
+struct decompressor {
+    int active; // Requested (and accepted once FNAME_OK is in)
+    z_stream zs; // Raw inflate, reset per chunk
+    uint64_t wire_bytes; // Payload bytes that came in compressed
+    uint64_t chunk_bytes; // What they inflated to
+};
+
+// Server side: rcopy's INIT_OPT_COMPRESS asked for level, chunks are up to buf_size. -1 if it can't
+int compress_init(struct compressor *c, int level, int32_t buf_size);
+
+// Server side: compressed length of the chunk (*out points at it), 0 if it goes raw
+int32_t compress_chunk(struct compressor *c, uint8_t *chunk, int32_t len, uint8_t **out);
+
+// Server side: ends the deflate stream
+void compress_free(struct compressor *c);
+
+// rcopy side: -1 if zlib can't be set up
+int decompress_init(struct decompressor *d);
+
+// rcopy side: inflates one payload into out (out_len bytes at most), returns the chunk length, -1 on a bad stream
+int32_t decompress_chunk(struct decompressor *d, uint8_t *data, int32_t len, uint8_t *out, int32_t out_len);
+
+#endif // COMPRESS_H
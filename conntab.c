@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "conntab.h"
+#include "rtt.h"
+
+static uint64_t conntab_mix(uint64_t h);
+static uint32_t conntab_hash(struct conntab *tab, struct sockaddr_in6 *address, uint32_t id);
+static uint32_t conntab_slot(struct conntab *tab, uint32_t hash, struct sockaddr_in6 *address, uint32_t id);
+static void conntab_grow(struct conntab *tab);
+
+void conntab_init(struct conntab *tab) {
+    tab->slots = calloc(CONNTAB_MIN_SLOTS, sizeof(struct conn_slot));
+    tab->mask = CONNTAB_MIN_SLOTS - 1;
+    tab->count = 0;
+    tab->seed = conntab_mix((uint64_t)rtt_now() ^ ((uint64_t)getpid() << 32) ^ (uintptr_t)tab);
+
+    if (tab->slots == NULL) {
+        printf("Error: Unable to allocate space for connection table.\n");
+        exit(1);
+    }
+}
+
+// The value for the client at address with connection ID id, NULL if there is none
+void *conntab_find(struct conntab *tab, struct sockaddr_in6 *address, uint32_t id) {
+    uint32_t i = conntab_slot(tab, conntab_hash(tab, address, id), address, id);
+
+    return tab->slots[i].value;
+}
+
+// Maps the client at address/id to value (not NULL), replacing what it mapped to before
+void conntab_add(struct conntab *tab, struct sockaddr_in6 *address, uint32_t id, void *value) {
+    uint32_t hash = conntab_hash(tab, address, id);
+    uint32_t i = 0;
+
+    if ((tab->count + 1) * CONNTAB_MAX_LOAD > tab->mask + 1) {
+        conntab_grow(tab);
+    }
+
+    i = conntab_slot(tab, hash, address, id);
+    if (tab->slots[i].hash == 0) {
+        tab->slots[i].hash = hash;
+        tab->slots[i].port = address->sin6_port;
+        tab->slots[i].id = id;
+        tab->slots[i].addr = address->sin6_addr;
+        tab->count++;
+    }
+    tab->slots[i].value = value;
+}
+
+// Drops the client at address/id. The entries behind it shift back, so no tombstones pile up
+void conntab_remove(struct conntab *tab, struct sockaddr_in6 *address, uint32_t id) {
+    uint32_t i = conntab_slot(tab, conntab_hash(tab, address, id), address, id);
+    uint32_t j = i;
+    uint32_t home = 0;
+
+    if (tab->slots[i].hash == 0) {
+        return;
+    }
+
+    // Every entry up to the next free slot moves into the hole if that keeps it at or past its
+    // home slot, then the hole is where it came from
+    while (1) {
+        j = (j + 1) & tab->mask;
+        if (tab->slots[j].hash == 0) {
+            break;
+        }
+
+        home = tab->slots[j].hash & tab->mask;
+        if (((j - home) & tab->mask) >= ((j - i) & tab->mask)) {
+            tab->slots[i] = tab->slots[j];
+            i = j;
+        }
+    }
+
+    memset(&tab->slots[i], 0, sizeof(struct conn_slot));
+    tab->count--;
+}
+
+// Gives back the slots, the values are the caller's
+void conntab_free(struct conntab *tab) {
+    free(tab->slots);
+    memset(tab, 0, sizeof(struct conntab));
+}
+
+// splitmix64 finalizer
+static uint64_t conntab_mix(uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+// Never 0, that marks a free slot
+static uint32_t conntab_hash(struct conntab *tab, struct sockaddr_in6 *address, uint32_t id) {
+    uint64_t words[2];
+    uint64_t h = tab->seed;
+    uint32_t hash = 0;
+
+    memcpy(words, &address->sin6_addr, sizeof(words));
+    h = conntab_mix(h ^ words[0]);
+    h = conntab_mix(h ^ words[1]);
+    h = conntab_mix(h ^ (((uint64_t)address->sin6_port << 32) | id));
+
+    hash = (uint32_t)(h >> 32);
+    return (hash != 0) ? hash : 1;
+}
+
+// The slot holding the key, or the free slot that ends its probe
+static uint32_t conntab_slot(struct conntab *tab, uint32_t hash, struct sockaddr_in6 *address, uint32_t id) {
+    uint32_t i = hash & tab->mask;
+    struct conn_slot *slot = NULL;
+
+    while (1) {
+        slot = &tab->slots[i];
+        if (slot->hash == 0) {
+            return i;
+        }
+        if ((slot->hash == hash) && (slot->port == address->sin6_port) && (slot->id == id)
+            && (memcmp(&slot->addr, &address->sin6_addr, sizeof(struct in6_addr)) == 0)) {
+            return i;
+        }
+        i = (i + 1) & tab->mask;
+    }
+}
+
+// Twice the slots, every entry reinserted from its stored hash
+static void conntab_grow(struct conntab *tab) {
+    struct conn_slot *old = tab->slots;
+    uint32_t old_slots = tab->mask + 1;
+    uint32_t i = 0;
+
+    tab->slots = calloc((size_t)old_slots * 2, sizeof(struct conn_slot));
+    if (tab->slots == NULL) {
+        printf("Error: Unable to allocate space for connection table.\n");
+        exit(1);
+    }
+    tab->mask = old_slots * 2 - 1;
+
+    for (uint32_t k = 0; k < old_slots; k++) {
+        if (old[k].hash == 0) {
+            continue;
+        }
+
+        i = old[k].hash & tab->mask;
+        while (tab->slots[i].hash != 0) {
+            i = (i + 1) & tab->mask;
+        }
+        tab->slots[i] = old[k];
+    }
+
+    free(old);
+}
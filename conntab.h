@@ -0,0 +1,42 @@
+#ifndef CONNTAB_H
+#define CONNTAB_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define CONNTAB_MIN_SLOTS 64 // Starting table size, always a power of two
+#define CONNTAB_MAX_LOAD 2 // Doubles before more than 1/CONNTAB_MAX_LOAD of the slots are taken
+
+// One client: the key (address, port, connection ID) and what it maps to. hash 0 marks a free slot
+struct conn_slot {
+    uint32_t hash; // Full hash of the key, compared before the key and reused on a resize
+    uint16_t port; // Network order, as in the sockaddr
+    uint32_t id; // Connection ID, 0 when the protocol carries none
+    struct in6_addr addr;
+    void *value;
+};
+
+// Open-addressing (linear probing) table from client to session. The slots are one flat array,
+// a probe walks neighbouring slots and only touches a key once its hash matched
+struct conntab {
+    struct conn_slot *slots;
+    uint32_t mask; // Slot count - 1
+    uint32_t count; // Slots in use
+    uint64_t seed; // Per table, so a client can't pick ports that all land on one slot
+};
+
+void conntab_init(struct conntab *tab);
+
+// The value for the client at address with connection ID id, NULL if there is none
+void *conntab_find(struct conntab *tab, struct sockaddr_in6 *address, uint32_t id);
+
+// Maps the client at address/id to value (not NULL), replacing what it mapped to before
+void conntab_add(struct conntab *tab, struct sockaddr_in6 *address, uint32_t id, void *value);
+
+// Drops the client at address/id. The entries behind it shift back, so no tombstones pile up
+void conntab_remove(struct conntab *tab, struct sockaddr_in6 *address, uint32_t id);
+
+// Gives back the slots, the values are the caller's
+void conntab_free(struct conntab *tab);
+
+#endif // CONNTAB_H
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "cwnd.h"
+
+// Starts in slow start at CWND_INITIAL, capped by the flow-control window
+void cwnd_init(struct cwnd *cc, int max_window) {
+    cc->max = max_window;
+    cc->cwnd = (CWND_INITIAL < max_window) ? CWND_INITIAL : max_window;
+    cc->ssthresh = max_window;
+    cc->recover = 0;
+}
+
+// Slow start adds one PDU per PDU acked, congestion avoidance one PDU per window
+void cwnd_ack(struct cwnd *cc, uint32_t acked) {
+    if (cc->cwnd < cc->ssthresh) {
+        cc->cwnd += acked;
+    }
+    else {
+        cc->cwnd += (double)acked / cc->cwnd;
+    }
+
+    if (cc->cwnd > cc->max) {
+        cc->cwnd = cc->max;
+    }
+}
+
+// SREJ for seq_num: halves the window once per window of data (next_seq is the next unsent PDU)
+void cwnd_loss(struct cwnd *cc, uint64_t seq_num, uint64_t next_seq) {
+    // Every hole in the window that was in flight when we last cut is the same congestion event
+    if (seq_num < cc->recover) {
+        return;
+    }
+
+    cc->ssthresh = cc->cwnd / 2;
+    if (cc->ssthresh < CWND_MIN) {
+        cc->ssthresh = CWND_MIN;
+    }
+
+    cc->cwnd = cc->ssthresh;
+    cc->recover = next_seq;
+}
+
+// Retransmission timeout: back to one PDU and slow start
+void cwnd_timeout(struct cwnd *cc, uint32_t in_flight, uint64_t next_seq) {
+    cc->ssthresh = in_flight / 2.0;
+    if (cc->ssthresh < CWND_MIN) {
+        cc->ssthresh = CWND_MIN;
+    }
+
+    cc->cwnd = 1;
+    cc->recover = next_seq;
+}
+
+// Whether another PDU may be sent with in_flight already outstanding
+int cwnd_allows(struct cwnd *cc, uint32_t in_flight) {
+    return in_flight < (uint32_t)cc->cwnd;
+}
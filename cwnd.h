@@ -0,0 +1,32 @@
+#ifndef CWND_H
+#define CWND_H
+
+#include <stdint.h>
+
+#define CWND_INITIAL 10 // Initial window in PDUs (RFC 6928)
+#define CWND_MIN 2 // ssthresh never drops below this
+
+// AIMD congestion window, counted in PDUs and kept apart from the flow-control window
+struct cwnd {
+    double cwnd; // PDUs allowed in flight
+    double ssthresh; // Slow start below this, congestion avoidance above
+    double max; // Never grow past the negotiated window
+    uint64_t recover; // Losses below this belong to a window that was already cut
+};
+
+// Starts in slow start at CWND_INITIAL, capped by the flow-control window
+void cwnd_init(struct cwnd *cc, int max_window);
+
+// Slow start adds one PDU per PDU acked, congestion avoidance one PDU per window
+void cwnd_ack(struct cwnd *cc, uint32_t acked);
+
+// SREJ for seq_num: halves the window once per window of data (next_seq is the next unsent PDU)
+void cwnd_loss(struct cwnd *cc, uint64_t seq_num, uint64_t next_seq);
+
+// Retransmission timeout: back to one PDU and slow start
+void cwnd_timeout(struct cwnd *cc, uint32_t in_flight, uint64_t next_seq);
+
+// Whether another PDU may be sent with in_flight already outstanding
+int cwnd_allows(struct cwnd *cc, uint32_t in_flight);
+
+#endif // CWND_H
@@ -0,0 +1,515 @@
+#define _GNU_SOURCE // copy_file_range
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+#include "pdu.h"
+#include "delta.h"
+
+#define DELTA_OUT_LEN (MAX_PAYLOAD + 2 * (DELTA_MAX_LITERAL + DELTA_LITERAL_LEN + 2 * DELTA_COPY_LEN)) // A PDU plus what one step can add
+#define DELTA_COPY_BUF 65536 // Bytes per pread/write when copy_file_range can't be used
+
+static void delta_sums(uint8_t *data, uint32_t len, uint32_t *s1, uint32_t *s2);
+static uint64_t delta_word(uint64_t w);
+static uint32_t delta_bucket(uint32_t weak);
+static int32_t delta_match(struct delta_encoder *d);
+static void delta_flush_run(struct delta_encoder *d);
+static void delta_literal(struct delta_encoder *d, uint64_t end);
+static void delta_step(struct delta_encoder *d);
+static int delta_copy(struct delta_decoder *d, int out_fd, uint32_t block, uint32_t count);
+
+// Signature block size for a file: about its square root, within DELTA_MIN_BLOCK..DELTA_MAX_BLOCK
+uint32_t delta_block_size(uint64_t size) {
+    uint32_t block = DELTA_MIN_BLOCK;
+
+    while (((uint64_t)block * block < size) && (block < DELTA_MAX_BLOCK)) {
+        block <<= 1;
+    }
+
+    return block;
+}
+
+// Rolling weak checksum of one block (rsync's): low half the byte sum, high half the position-weighted sum
+uint32_t delta_weak(uint8_t *data, uint32_t len) {
+    uint32_t s1 = 0;
+    uint32_t s2 = 0;
+
+    delta_sums(data, len, &s1, &s2);
+    return (s1 & 0xFFFF) | (s2 << 16);
+}
+
+// Strong 64-bit hash of one block, 8 bytes a step. Little-endian words so both ends agree
+uint64_t delta_strong(uint8_t *data, uint32_t len) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ len;
+    uint64_t w = 0;
+    uint32_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, data + i, 8);
+        h ^= delta_word(le64toh(w));
+        h = ((h << 27) | (h >> 37)) * 5 + 0x52DCE729;
+    }
+
+    w = 0;
+    for (uint32_t j = 0; i + j < len; j++) {
+        w |= (uint64_t)data[i + j] << (8 * j);
+    }
+    h ^= delta_word(w);
+
+    // Final avalanche
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+// Server side: rcopy's INIT_OPT_DELTA asked for block_count signatures of block_size, -1 if it can't
+int delta_encoder_init(struct delta_encoder *d, uint32_t block_size, uint32_t block_count) {
+    memset(d, 0, sizeof(struct delta_encoder));
+
+    if ((block_size < DELTA_MIN_BLOCK) || (block_size > DELTA_MAX_BLOCK) || (block_count == 0) || (block_count > DELTA_MAX_BLOCKS)) {
+        return -1;
+    }
+
+    d->sigs = (struct delta_sig *) malloc(block_count * sizeof(struct delta_sig));
+    d->out = (uint8_t *) malloc(DELTA_OUT_LEN);
+    if ((d->sigs == NULL) || (d->out == NULL)) {
+        free(d->sigs);
+        free(d->out);
+        return -1;
+    }
+
+    d->block_size = block_size;
+    d->block_count = block_count;
+    d->active = 1;
+
+    return 0;
+}
+
+// Server side: takes a DELTA_SIG payload (first index, then signatures) if it is the next one due
+void delta_sigs_add(struct delta_encoder *d, uint8_t *payload, int32_t len) {
+    uint32_t first = 0;
+    uint32_t count = 0;
+    uint32_t net[3];
+
+    if (len < 4) {
+        return;
+    }
+
+    memcpy(&first, payload, 4);
+    if (ntohl(first) != d->received) {
+        return; // A repeat, or past a lost one (the RR asks for that one again)
+    }
+
+    count = (len - 4) / DELTA_SIG_LEN;
+    if (count > d->block_count - d->received) {
+        count = d->block_count - d->received;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        memcpy(net, payload + 4 + i * DELTA_SIG_LEN, DELTA_SIG_LEN);
+        d->sigs[d->received].weak = ntohl(net[0]);
+        d->sigs[d->received].strong = ((uint64_t)ntohl(net[1]) << 32) | ntohl(net[2]);
+        d->received++;
+    }
+}
+
+// Server side: all signatures are in, indexes them and maps the source. -1 on failure
+int delta_encoder_start(struct delta_encoder *d, int data_file) {
+    struct stat st;
+    uint32_t buckets = 1;
+
+    while (buckets < 2 * d->block_count) {
+        buckets <<= 1;
+    }
+
+    d->buckets = (int32_t *) malloc(buckets * sizeof(int32_t));
+    d->chain = (int32_t *) malloc(d->block_count * sizeof(int32_t));
+    if ((d->buckets == NULL) || (d->chain == NULL)) {
+        return -1;
+    }
+
+    d->mask = buckets - 1;
+    memset(d->buckets, 0xFF, buckets * sizeof(int32_t));
+
+    // Inserted back to front so each chain lists blocks in file order
+    for (int32_t j = d->block_count - 1; j >= 0; j--) {
+        uint32_t b = delta_bucket(d->sigs[j].weak) & d->mask;
+        d->chain[j] = d->buckets[b];
+        d->buckets[b] = j;
+    }
+
+    if (fstat(data_file, &st) < 0) {
+        return -1;
+    }
+
+    d->size = st.st_size;
+    if (d->size > 0) {
+        d->src = mmap(NULL, d->size, PROT_READ, MAP_PRIVATE, data_file, 0);
+        if (d->src == MAP_FAILED) {
+            return -1;
+        }
+        madvise(d->src, d->size, MADV_SEQUENTIAL);
+    }
+
+    return 0;
+}
+
+// Server side: next len bytes of the delta stream, short only at its end (read() semantics)
+int32_t delta_read(struct delta_encoder *d, uint8_t *buf, int32_t len) {
+    uint32_t have = 0;
+
+    while ((d->out_end - d->out_start < (uint32_t)len) && !d->done) {
+        if (d->out_start != 0) {
+            memmove(d->out, d->out + d->out_start, d->out_end - d->out_start);
+            d->out_end -= d->out_start;
+            d->out_start = 0;
+        }
+        delta_step(d);
+    }
+
+    have = d->out_end - d->out_start;
+    if (have > (uint32_t)len) {
+        have = len;
+    }
+
+    memcpy(buf, d->out + d->out_start, have);
+    d->out_start += have;
+
+    return have;
+}
+
+// Server side: unmaps the source and gives the tables back
+void delta_encoder_free(struct delta_encoder *d) {
+    if ((d->src != NULL) && (d->src != MAP_FAILED)) {
+        munmap(d->src, d->size);
+    }
+    free(d->sigs);
+    free(d->buckets);
+    free(d->chain);
+    free(d->out);
+    memset(d, 0, sizeof(struct delta_encoder));
+}
+
+// rcopy side: signs the existing output file, -1 if there is nothing to diff against
+int delta_signatures(struct delta_decoder *d, char *output) {
+    struct stat st;
+    uint8_t *block = NULL;
+
+    memset(d, 0, sizeof(struct delta_decoder));
+    snprintf(d->path, sizeof(d->path), "%s", output);
+    snprintf(d->tmp, sizeof(d->tmp), "%s.delta", output);
+
+    if ((d->basis_fd = open(output, O_RDONLY)) < 0) {
+        return -1;
+    }
+
+    // Under one block there is nothing worth matching
+    if ((fstat(d->basis_fd, &st) < 0) || (st.st_size < DELTA_MIN_BLOCK)) {
+        close(d->basis_fd);
+        return -1;
+    }
+
+    d->block_size = delta_block_size(st.st_size);
+    d->block_count = st.st_size / d->block_size;
+    if (d->block_count > DELTA_MAX_BLOCKS) {
+        close(d->basis_fd);
+        return -1;
+    }
+
+    d->sigs = (struct delta_sig *) malloc(d->block_count * sizeof(struct delta_sig));
+    block = (uint8_t *) malloc(d->block_size);
+    if ((d->sigs == NULL) || (block == NULL)) {
+        free(block);
+        free(d->sigs);
+        d->sigs = NULL;
+        close(d->basis_fd);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < d->block_count; i++) {
+        if (pread(d->basis_fd, block, d->block_size, (off_t)i * d->block_size) != d->block_size) {
+            free(block);
+            free(d->sigs);
+            d->sigs = NULL;
+            close(d->basis_fd);
+            return -1;
+        }
+
+        d->sigs[i].weak = delta_weak(block, d->block_size);
+        d->sigs[i].strong = delta_strong(block, d->block_size);
+    }
+
+    free(block);
+    d->active = 1;
+
+    return 0;
+}
+
+// rcopy side: builds a DELTA_SIG payload starting at signature first, returns its length (*count signatures)
+int32_t delta_sig_payload(struct delta_decoder *d, uint32_t first, uint8_t *payload, uint32_t *count) {
+    uint32_t net_first = htonl(first);
+    uint32_t net[3];
+
+    *count = d->block_count - first;
+    if (*count > DELTA_SIG_PDU_SIGS) {
+        *count = DELTA_SIG_PDU_SIGS;
+    }
+
+    memcpy(payload, &net_first, 4);
+    for (uint32_t i = 0; i < *count; i++) {
+        net[0] = htonl(d->sigs[first + i].weak);
+        net[1] = htonl(d->sigs[first + i].strong >> 32);
+        net[2] = htonl(d->sigs[first + i].strong & 0xFFFFFFFF);
+        memcpy(payload + 4 + i * DELTA_SIG_LEN, net, DELTA_SIG_LEN);
+    }
+
+    return 4 + *count * DELTA_SIG_LEN;
+}
+
+// rcopy side: applies the next bytes of the delta stream, writing the new file to out_fd. -1 on a bad stream.
+// Records run across PDU boundaries, a partial header waits in d->head
+int delta_apply(struct delta_decoder *d, int out_fd, uint8_t *data, int32_t len) {
+    while (len > 0) {
+        if (d->literal_left != 0) {
+            int32_t n = (d->literal_left < (uint32_t)len) ? (int32_t)d->literal_left : len;
+            if (write(out_fd, data, n) != n) {
+                return -1;
+            }
+
+            d->literal_left -= n;
+            d->literal_bytes += n;
+            data += n;
+            len -= n;
+            continue;
+        }
+
+        d->head[d->head_len++] = *data++;
+        len--;
+
+        if (d->head[0] == DELTA_LITERAL) {
+            if (d->head_len == DELTA_LITERAL_LEN) {
+                uint16_t net_len = 0;
+                memcpy(&net_len, d->head + 1, 2);
+                d->literal_left = ntohs(net_len);
+                d->head_len = 0;
+            }
+        }
+        else if (d->head[0] == DELTA_COPY) {
+            if (d->head_len == DELTA_COPY_LEN) {
+                uint32_t net[2];
+                memcpy(net, d->head + 1, 8);
+                d->head_len = 0;
+
+                if (delta_copy(d, out_fd, ntohl(net[0]), ntohl(net[1])) < 0) {
+                    return -1;
+                }
+            }
+        }
+        else {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// rcopy side: new file complete, replaces the old one
+int delta_finish(struct delta_decoder *d) {
+    close(d->basis_fd);
+    return rename(d->tmp, d->path);
+}
+
+// Byte sum and position-weighted sum the weak checksum is built from
+static void delta_sums(uint8_t *data, uint32_t len, uint32_t *s1, uint32_t *s2) {
+    uint32_t a = 0;
+    uint32_t b = 0;
+
+    for (uint32_t i = 0; i < len; i++) {
+        a += data[i];
+        b += (len - i) * data[i];
+    }
+
+    *s1 = a;
+    *s2 = b;
+}
+
+// Scrambles one word before it is folded into the strong hash
+static uint64_t delta_word(uint64_t w) {
+    w *= 0x87C37B91114253D5ULL;
+    w = (w << 31) | (w >> 33);
+    return w * 0x4CF5AD432745937FULL;
+}
+
+static uint32_t delta_bucket(uint32_t weak) {
+    return (weak ^ (weak >> 16)) * 0x9E3779B1;
+}
+
+// Block rcopy has that matches src[pos, pos + block_size), -1 if none. The block after the
+// current run is tried first so the run stays one record
+static int32_t delta_match(struct delta_encoder *d) {
+    uint32_t weak = (d->s1 & 0xFFFF) | (d->s2 << 16);
+    uint32_t next = d->run_block + d->run_count;
+    uint64_t strong = 0;
+    int have_strong = 0;
+
+    if ((d->run_count != 0) && (next < d->block_count) && (d->sigs[next].weak == weak)) {
+        strong = delta_strong(d->src + d->pos, d->block_size);
+        have_strong = 1;
+
+        if (strong == d->sigs[next].strong) {
+            return next;
+        }
+    }
+
+    for (int32_t j = d->buckets[delta_bucket(weak) & d->mask]; j >= 0; j = d->chain[j]) {
+        if (d->sigs[j].weak != weak) {
+            continue;
+        }
+
+        if (!have_strong) {
+            strong = delta_strong(d->src + d->pos, d->block_size);
+            have_strong = 1;
+        }
+        if (strong == d->sigs[j].strong) {
+            return j;
+        }
+    }
+
+    return -1;
+}
+
+// Emits the pending copy run
+static void delta_flush_run(struct delta_encoder *d) {
+    uint32_t net[2] = {htonl(d->run_block), htonl(d->run_count)};
+
+    if (d->run_count == 0) {
+        return;
+    }
+
+    d->out[d->out_end] = DELTA_COPY;
+    memcpy(d->out + d->out_end + 1, net, 8);
+    d->out_end += DELTA_COPY_LEN;
+    d->run_count = 0;
+}
+
+// Emits one literal record for the source bytes from d->literal up to end (at most DELTA_MAX_LITERAL of them)
+static void delta_literal(struct delta_encoder *d, uint64_t end) {
+    uint32_t n = end - d->literal;
+    uint16_t net_len = 0;
+
+    delta_flush_run(d);
+
+    if (n > DELTA_MAX_LITERAL) {
+        n = DELTA_MAX_LITERAL;
+    }
+    net_len = htons(n);
+
+    d->out[d->out_end] = DELTA_LITERAL;
+    memcpy(d->out + d->out_end + 1, &net_len, 2);
+    memcpy(d->out + d->out_end + DELTA_LITERAL_LEN, d->src + d->literal, n);
+    d->out_end += DELTA_LITERAL_LEN + n;
+    d->literal += n;
+}
+
+// Matches forward until a record is due: a block match, a full literal, or the end of the source.
+// Adds at most one literal and two copy records to d->out
+static void delta_step(struct delta_encoder *d) {
+    uint32_t b = d->block_size;
+
+    while (!d->done) {
+        // Tail shorter than a block goes as literals
+        if (d->pos + b > d->size) {
+            if (d->literal < d->size) {
+                delta_literal(d, d->size);
+                return;
+            }
+
+            delta_flush_run(d);
+            d->done = 1;
+            return;
+        }
+
+        if (!d->rolling) {
+            delta_sums(d->src + d->pos, b, &d->s1, &d->s2);
+            d->rolling = 1;
+        }
+
+        int32_t j = delta_match(d);
+        if (j >= 0) {
+            if (d->literal < d->pos) {
+                delta_literal(d, d->pos);
+            }
+
+            if ((d->run_count != 0) && ((uint32_t)j == d->run_block + d->run_count)) {
+                d->run_count++;
+            }
+            else {
+                delta_flush_run(d);
+                d->run_block = j;
+                d->run_count = 1;
+            }
+
+            d->pos += b;
+            d->literal = d->pos;
+            d->rolling = 0;
+            return;
+        }
+
+        // Slide one byte
+        if (d->pos + b < d->size) {
+            uint8_t out = d->src[d->pos];
+            uint8_t in = d->src[d->pos + b];
+            d->s1 = d->s1 - out + in;
+            d->s2 = d->s2 - b * out + d->s1;
+        }
+        d->pos++;
+
+        if (d->pos - d->literal >= DELTA_MAX_LITERAL) {
+            delta_literal(d, d->pos);
+            return;
+        }
+    }
+}
+
+// Copies a run of old blocks into the new file, in the kernel when it can
+static int delta_copy(struct delta_decoder *d, int out_fd, uint32_t block, uint32_t count) {
+    static uint8_t buf[DELTA_COPY_BUF];
+    off_t offset = (off_t)block * d->block_size;
+    uint64_t left = (uint64_t)count * d->block_size;
+
+    if ((uint64_t)block + count > d->block_count) {
+        return -1;
+    }
+
+    d->copied += left;
+
+    while (left > 0) {
+        ssize_t n = copy_file_range(d->basis_fd, &offset, out_fd, NULL, left, 0);
+        if (n <= 0) {
+            break;
+        }
+        left -= n;
+    }
+
+    while (left > 0) {
+        ssize_t n = pread(d->basis_fd, buf, (left < DELTA_COPY_BUF) ? left : DELTA_COPY_BUF, offset);
+        if ((n <= 0) || (write(out_fd, buf, n) != n)) {
+            return -1;
+        }
+        offset += n;
+        left -= n;
+    }
+
+    return 0;
+}
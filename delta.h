@@ -0,0 +1,102 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdint.h>
+
+#define DELTA_MIN_BLOCK 512 // Smallest signature block
+#define DELTA_MAX_BLOCK 65536 // Largest signature block
+#define DELTA_MAX_BLOCKS (1 << 24) // Most signatures the server takes for one file
+#define DELTA_SIG_LEN 12 // Weak (4) + strong (8) hash per block
+#define DELTA_SIG_PDU_SIGS 116 // Signatures per DELTA_SIG PDU: first index (4) + 116 * 12 bytes fits MAXBUF
+#define DELTA_SIG_BURST 16 // DELTA_SIG PDUs rcopy sends before it waits for the RR
+#define DELTA_MAX_LITERAL 4096 // Longest literal record
+
+// Delta stream records, carried in the DATA payloads in place of the file
+#define DELTA_COPY 1 // First block (4), block count (4): copy that run of the old file
+#define DELTA_LITERAL 2 // Length (2), then that many new bytes
+#define DELTA_COPY_LEN 9
+#define DELTA_LITERAL_LEN 3
+
+struct delta_sig {
+    uint32_t weak; // Rolling checksum, cheap to slide one byte
+    uint64_t strong; // Confirms a weak match
+};
+
+// Server side: matches the source against rcopy's signatures and hands out the delta stream
+struct delta_encoder {
+    int active; // Delta transfer negotiated, read_chunk takes its bytes from delta_read
+    uint32_t block_size;
+    uint32_t block_count;
+    uint32_t received; // Signatures in so far
+    struct delta_sig *sigs;
+    int32_t *buckets; // Weak hash -> first block with it
+    int32_t *chain; // Next block in the same bucket, -1 ends it
+    uint32_t mask; // Buckets - 1
+    uint8_t *src; // Source file, mapped
+    uint64_t size;
+    uint64_t pos; // Start of the block being matched
+    uint64_t literal; // First source byte not in a record yet
+    uint32_t s1; // Rolling checksum halves over src[pos, pos + block_size)
+    uint32_t s2;
+    int rolling; // s1/s2 are current for pos
+    uint32_t run_block; // Pending copy run, merged while matches stay consecutive
+    uint32_t run_count;
+    uint8_t *out; // Records not handed out yet
+    uint32_t out_start;
+    uint32_t out_end;
+    int done; // Whole source is in records
+};
+
+// rcopy side: the old file's signatures, and the stream rebuilding the new file next to it
+struct delta_decoder {
+    int active; // Delta transfer requested (and accepted once FNAME_OK is in)
+    int basis_fd; // Old file, copies come from here
+    uint32_t block_size;
+    uint32_t block_count;
+    struct delta_sig *sigs;
+    uint8_t head[DELTA_COPY_LEN]; // Record header split across PDUs
+    int head_len;
+    uint32_t literal_left; // Bytes of the current literal still to come
+    uint64_t copied; // Bytes taken from the old file
+    uint64_t literal_bytes; // Bytes that came over the wire
+    char path[256]; // Output file
+    char tmp[264]; // New file is built here, renamed over path at the end
+};
+
+// Signature block size for a file: about its square root, within DELTA_MIN_BLOCK..DELTA_MAX_BLOCK
+uint32_t delta_block_size(uint64_t size);
+
+// Rolling weak checksum of one block
+uint32_t delta_weak(uint8_t *data, uint32_t len);
+
+// Strong 64-bit hash of one block
+uint64_t delta_strong(uint8_t *data, uint32_t len);
+
+// Server side: rcopy's INIT_OPT_DELTA asked for block_count signatures of block_size, -1 if it can't
+int delta_encoder_init(struct delta_encoder *d, uint32_t block_size, uint32_t block_count);
+
+// Server side: takes a DELTA_SIG payload (first index, then signatures) if it is the next one due
+void delta_sigs_add(struct delta_encoder *d, uint8_t *payload, int32_t len);
+
+// Server side: all signatures are in, indexes them and maps the source. -1 on failure
+int delta_encoder_start(struct delta_encoder *d, int data_file);
+
+// Server side: next len bytes of the delta stream, short only at its end (read() semantics)
+int32_t delta_read(struct delta_encoder *d, uint8_t *buf, int32_t len);
+
+// Server side: unmaps the source and gives the tables back
+void delta_encoder_free(struct delta_encoder *d);
+
+// rcopy side: signs the existing output file, -1 if there is nothing to diff against
+int delta_signatures(struct delta_decoder *d, char *output);
+
+// rcopy side: builds a DELTA_SIG payload starting at signature first, returns its length (*count signatures)
+int32_t delta_sig_payload(struct delta_decoder *d, uint32_t first, uint8_t *payload, uint32_t *count);
+
+// rcopy side: applies the next bytes of the delta stream, writing the new file to out_fd. -1 on a bad stream
+int delta_apply(struct delta_decoder *d, int out_fd, uint8_t *data, int32_t len);
+
+// rcopy side: new file complete, replaces the old one
+int delta_finish(struct delta_decoder *d);
+
+#endif // DELTA_H
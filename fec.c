@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#include "pdu.h"
+#include "window.h"
+#include "fec.h"
+
+static void fec_xor(uint8_t *dst, uint8_t *src, int32_t len);
+static void fec_header(uint8_t *pdu, uint64_t seq_num, uint8_t flag, int32_t len);
+static void fec_adapt(struct fec_encoder *fec);
+static int fec_holes(uint8_t *parity, struct window *w, uint64_t expected, uint64_t *missing);
+static int fec_decode(struct fec_decoder *fec, uint8_t *parity, int32_t len, struct window *w, uint64_t expected, int32_t *out_len);
+
+// Group size the server agrees to for a requested one (0 turns parity off). Groups fit in half the
+// receive window so rcopy still holds a group's PDUs when its parity shows up
+int fec_negotiate(int requested, int window_size) {
+    int max_k = window_size / 2;
+
+    if (max_k > FEC_MAX_K) {
+        max_k = FEC_MAX_K;
+    }
+
+    if ((requested <= 0) || (max_k < FEC_MIN_K)) {
+        return 0;
+    }
+    if (requested == FEC_ADAPTIVE) {
+        return FEC_ADAPTIVE;
+    }
+
+    if (requested < FEC_MIN_K) {
+        return FEC_MIN_K;
+    }
+    return (requested > max_k) ? max_k : requested;
+}
+
+// Server side: k from fec_negotiate, FEC_ADAPTIVE starts at FEC_ADAPT_START
+void fec_encoder_init(struct fec_encoder *fec, int k, int32_t buf_size, int window_size) {
+    memset(fec, 0, sizeof(struct fec_encoder));
+
+    fec->max_k = (window_size / 2 < FEC_MAX_K) ? window_size / 2 : FEC_MAX_K;
+    fec->adaptive = (k == FEC_ADAPTIVE);
+    fec->k = fec->adaptive ? FEC_ADAPT_START : k;
+
+    if (fec->k > fec->max_k) {
+        fec->k = fec->max_k;
+    }
+    if (fec->k < FEC_MIN_K) {
+        fec->k = 0;
+        return;
+    }
+
+    // A window burst closes at most window_size / FEC_MIN_K groups, plus the one left open
+    fec->parity_len = PDU_HEADER_LEN + FEC_HEADER_LEN + buf_size;
+    fec->ring_size = window_size / FEC_MIN_K + 2;
+    fec->ring = calloc(fec->ring_size, (size_t)fec->parity_len);
+
+    if (fec->ring == NULL) {
+        printf("Error: Unable to allocate space for parity.\n");
+        exit(1);
+    }
+}
+
+// Folds a DATA PDU (its flag and payload) into the open group. Returns the parity PDU length (parity points at it) when the group closes, else 0
+int32_t fec_add(struct fec_encoder *fec, uint8_t flag, uint8_t *payload, int32_t payload_len, uint64_t seq_num, uint8_t **parity) {
+    if (fec->k == 0) {
+        return 0;
+    }
+
+    uint8_t *xor = fec->ring + (size_t)fec->ring_next * fec->parity_len + PDU_HEADER_LEN + FEC_HEADER_LEN;
+
+    // The first payload starts the XOR, shorter payloads are zero padded
+    if (fec->count == 0) {
+        fec->start = seq_num;
+        fec->len_xor = 0;
+        fec->flag_xor = 0;
+        fec->max_len = 0;
+        memcpy(xor, payload, payload_len);
+        memset(xor + payload_len, 0, fec->parity_len - PDU_HEADER_LEN - FEC_HEADER_LEN - payload_len);
+    }
+    else {
+        fec_xor(xor, payload, payload_len);
+    }
+
+    fec->len_xor ^= (uint16_t)payload_len;
+    fec->flag_xor ^= flag & PDU_COMPRESSED;
+    if (payload_len > fec->max_len) {
+        fec->max_len = payload_len;
+    }
+    fec->count++;
+    fec->sent++;
+
+    if (fec->count < fec->k) {
+        return 0;
+    }
+    return fec_flush(fec, parity);
+}
+
+// Closes a partial group early (before EOF or when the window stalls), 0 if nothing is open
+int32_t fec_flush(struct fec_encoder *fec, uint8_t **parity) {
+    if (fec->count == 0) {
+        return 0;
+    }
+
+    uint8_t *open = fec->ring + (size_t)fec->ring_next * fec->parity_len;
+    uint16_t net_count = htons((uint16_t)fec->count | (fec->flag_xor ? FEC_COMPRESSED : 0));
+    uint16_t net_len = htons(fec->len_xor);
+    int32_t len = PDU_HEADER_LEN + FEC_HEADER_LEN + fec->max_len;
+
+    memcpy(open + PDU_HEADER_LEN, &net_count, 2);
+    memcpy(open + PDU_HEADER_LEN + 2, &net_len, 2);
+    fec_header(open, fec->start, FEC_PARITY, len);
+
+    *parity = open;
+    fec->count = 0;
+    fec->ring_next = (fec->ring_next + 1) % fec->ring_size;
+
+    // Group size only changes between groups
+    if (fec->adaptive && (fec->sent >= FEC_ADAPT_INTERVAL)) {
+        fec_adapt(fec);
+    }
+
+    return len;
+}
+
+// Holes the receiver reported (SREJ/SACK), losses the parity did not cover
+void fec_loss(struct fec_encoder *fec, uint32_t lost) {
+    fec->lost += lost;
+}
+
+// Server side: gives the parity buffers back
+void fec_encoder_free(struct fec_encoder *fec) {
+    free(fec->ring);
+    fec->ring = NULL;
+    fec->k = 0;
+}
+
+// Halves the group while losses get past the parity, otherwise gives one PDU of overhead back per sample
+static void fec_adapt(struct fec_encoder *fec) {
+    double loss = (double)fec->lost / fec->sent;
+
+    if (loss > FEC_LOSS_TARGET) {
+        fec->k = (fec->k / 2 > FEC_MIN_K) ? fec->k / 2 : FEC_MIN_K;
+    }
+    else if (fec->k < fec->max_k) {
+        fec->k++;
+    }
+
+    fec->sent = 0;
+    fec->lost = 0;
+}
+
+// rcopy side: slot_len is the negotiated DATA PDU length
+void fec_decoder_init(struct fec_decoder *fec, int32_t slot_len) {
+    memset(fec, 0, sizeof(struct fec_decoder));
+
+    fec->slot_len = FEC_HEADER_LEN + slot_len;
+    fec->pending = calloc(FEC_PENDING, (size_t)fec->slot_len);
+    fec->recovered = calloc(1, (size_t)fec->slot_len);
+
+    if ((fec->pending == NULL) || (fec->recovered == NULL)) {
+        printf("Error: Unable to allocate space for parity.\n");
+        exit(1);
+    }
+}
+
+// Takes a parity PDU. Returns the length of a rebuilt DATA PDU (in fec->recovered), 0 if nothing could be rebuilt
+int32_t fec_receive(struct fec_decoder *fec, uint8_t *parity, int32_t len, struct window *w, uint64_t expected) {
+    uint64_t start = 0;
+    uint32_t count = 0;
+    int32_t out_len = 0;
+    int oldest = 0;
+
+    if ((len < PDU_HEADER_LEN + FEC_HEADER_LEN) || (len > fec->slot_len)) {
+        return 0;
+    }
+
+    fec_group(parity, expected, &start, &count);
+    if (start + count > fec->parity_next) {
+        fec->parity_next = start + count;
+    }
+
+    int result = fec_decode(fec, parity, len, w, expected, &out_len);
+    if (result >= 0) {
+        return out_len;
+    }
+
+    // Short more than one PDU: hold it for a retransmission, pushing out the oldest group if full
+    for (int i = 0; i < FEC_PENDING; i++) {
+        uint64_t i_start = 0;
+        uint64_t oldest_start = 0;
+
+        if (fec->pending_len[i] == 0) {
+            oldest = i;
+            break;
+        }
+
+        fec_group(fec->pending + (size_t)i * fec->slot_len, expected, &i_start, &count);
+        fec_group(fec->pending + (size_t)oldest * fec->slot_len, expected, &oldest_start, &count);
+        if (i_start < oldest_start) {
+            oldest = i;
+        }
+    }
+
+    memcpy(fec->pending + (size_t)oldest * fec->slot_len, parity, len);
+    fec->pending_len[oldest] = len;
+
+    return 0;
+}
+
+// Tries the held parity PDUs again after more data came in, same return as fec_receive
+int32_t fec_retry(struct fec_decoder *fec, struct window *w, uint64_t expected) {
+    int32_t out_len = 0;
+
+    for (int i = 0; i < FEC_PENDING; i++) {
+        if (fec->pending_len[i] == 0) {
+            continue;
+        }
+
+        // Rebuilt, complete or gone from the window: either way it is done
+        int result = fec_decode(fec, fec->pending + (size_t)i * fec->slot_len, fec->pending_len[i], w, expected, &out_len);
+        if (result >= 0) {
+            fec->pending_len[i] = 0;
+        }
+        if (result > 0) {
+            return out_len;
+        }
+    }
+
+    return 0;
+}
+
+// Whether a held parity PDU can rebuild seq_num right now
+int fec_repairable(struct fec_decoder *fec, struct window *w, uint64_t expected, uint64_t seq_num) {
+    uint64_t missing = 0;
+
+    for (int i = 0; i < FEC_PENDING; i++) {
+        if ((fec->pending_len[i] != 0) && (fec_holes(fec->pending + (size_t)i * fec->slot_len, w, expected, &missing) == 1) && (missing == seq_num)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Sequence numbers a parity PDU covers (its header has the low 32 bits of the first, near places them)
+void fec_group(uint8_t *parity, uint64_t near, uint64_t *start, uint32_t *count) {
+    uint32_t net_start = 0;
+    uint16_t net_count = 0;
+
+    memcpy(&net_start, parity, 4);
+    memcpy(&net_count, parity + PDU_HEADER_LEN, 2);
+    *start = seq_expand(ntohl(net_start), near);
+    *count = ntohs(net_count) & ~FEC_COMPRESSED;
+}
+
+// PDUs of the group still missing (the last one in missing), -1 if one the XOR needs has left the window.
+// Below expected a PDU was written but its slot keeps it until seq + size arrives
+static int fec_holes(uint8_t *parity, struct window *w, uint64_t expected, uint64_t *missing) {
+    uint64_t start = 0;
+    uint32_t count = 0;
+    int32_t len = 0;
+    int holes = 0;
+
+    fec_group(parity, expected, &start, &count);
+    if ((count == 0) || (count > (uint32_t)w->size)) {
+        return -1;
+    }
+
+    for (uint64_t seq = start; seq < start + count; seq++) {
+        if (seq >= expected) {
+            if (!window_has(w, seq)) {
+                *missing = seq;
+                holes++;
+            }
+        }
+        else if (window_find(w, seq, &len) == NULL) {
+            return -1;
+        }
+    }
+
+    return holes;
+}
+
+// 1 rebuilt the one missing PDU into fec->recovered, 0 nothing left to rebuild (or can't be), -1 still short more than one PDU
+static int fec_decode(struct fec_decoder *fec, uint8_t *parity, int32_t len, struct window *w, uint64_t expected, int32_t *out_len) {
+    uint64_t start = 0;
+    uint32_t count = 0;
+    uint64_t missing = 0;
+    uint16_t len_xor = 0;
+    uint16_t net_count = 0;
+    uint8_t flag = DATA;
+    int32_t parity_payload = len - PDU_HEADER_LEN - FEC_HEADER_LEN;
+    int32_t pdu_len = 0;
+
+    int holes = fec_holes(parity, w, expected, &missing);
+    if (holes > 1) {
+        return -1;
+    }
+    if (holes != 1) {
+        return 0;
+    }
+
+    fec_group(parity, expected, &start, &count);
+    memcpy(&len_xor, parity + PDU_HEADER_LEN + 2, 2);
+    len_xor = ntohs(len_xor);
+    memcpy(&net_count, parity + PDU_HEADER_LEN, 2);
+    if (ntohs(net_count) & FEC_COMPRESSED) {
+        flag ^= PDU_COMPRESSED;
+    }
+
+    // XOR of the parity and every other payload in the group is the missing payload
+    uint8_t *payload = fec->recovered + PDU_HEADER_LEN;
+    memcpy(payload, parity + PDU_HEADER_LEN + FEC_HEADER_LEN, parity_payload);
+
+    for (uint64_t seq = start; seq < start + count; seq++) {
+        if (seq == missing) {
+            continue;
+        }
+
+        uint8_t *pdu = window_find(w, seq, &pdu_len);
+        if ((pdu_len - PDU_HEADER_LEN) > parity_payload) {
+            return 0;
+        }
+
+        fec_xor(payload, pdu + PDU_HEADER_LEN, pdu_len - PDU_HEADER_LEN);
+        len_xor ^= (uint16_t)(pdu_len - PDU_HEADER_LEN);
+        flag ^= pdu[PDU_HEADER_LEN - flagLen] & PDU_COMPRESSED;
+    }
+
+    if ((len_xor == 0) || (len_xor > parity_payload)) {
+        return 0;
+    }
+
+    *out_len = PDU_HEADER_LEN + len_xor;
+    fec_header(fec->recovered, missing, flag, *out_len);
+    return 1;
+}
+
+// dst ^= src, a word at a time
+static void fec_xor(uint8_t *dst, uint8_t *src, int32_t len) {
+    int32_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t a = 0;
+        uint64_t b = 0;
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+
+    for (; i < len; i++) {
+        dst[i] ^= src[i];
+    }
+}
+
+// Fills in the header of a PDU whose payload is already in place
+static void fec_header(uint8_t *pdu, uint64_t seq_num, uint8_t flag, int32_t len) {
+    uint32_t net_seq = htonl((uint32_t)seq_num);
+    uint16_t checksum = 0;
+
+    memcpy(pdu, &net_seq, seqNumLen);
+    memset(pdu + seqNumLen, 0, chkSumLen);
+    memcpy(pdu + seqNumLen + chkSumLen, &flag, flagLen);
+
+    checksum = in_cksum((unsigned short *)pdu, len);
+    memcpy(pdu + seqNumLen, &checksum, chkSumLen);
+}
@@ -0,0 +1,78 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+#include "window.h"
+
+#define FEC_ADAPTIVE 0xFFFF // Requested group size: the server sizes groups from the loss it sees
+#define FEC_MIN_K 2 // Smallest group, one parity PDU for every two DATA PDUs
+#define FEC_MAX_K 64 // Largest group
+#define FEC_ADAPT_START 16 // Adaptive group size before the first loss sample
+#define FEC_ADAPT_INTERVAL 256 // DATA PDUs per loss sample in adaptive mode
+#define FEC_LOSS_TARGET 0.001 // Adaptive mode shrinks groups while more losses than this get past the parity
+#define FEC_PENDING 16 // Parity PDUs rcopy holds while their group is missing more than one PDU
+#define FEC_COMPRESSED 0x8000 // Group size bit: XOR of the group's PDU_COMPRESSED bits, so a rebuilt PDU gets its own back
+
+// Server side: XORs each group of k DATA payloads into one FEC_PARITY PDU
+struct fec_encoder {
+    int k; // Group size, 0 sends no parity
+    int max_k; // Largest group the receive window can still rebuild from
+    int adaptive; // k follows the loss rate
+    int count; // DATA PDUs folded into the open group
+    uint64_t start; // First sequence number of the open group
+    uint16_t len_xor; // XOR of the open group's payload lengths
+    uint8_t flag_xor; // XOR of the open group's PDU_COMPRESSED bits
+    int32_t max_len; // Longest payload in the open group
+    int32_t parity_len; // Bytes per parity buffer
+    int ring_size; // Parity buffers, enough for every group one window burst can close
+    int ring_next; // Buffer the open group accumulates in
+    uint8_t *ring; // Parity PDUs stay here until the batch that queued them is sent
+    uint32_t sent; // DATA PDUs in the current loss sample
+    uint32_t lost; // Holes reported in the current loss sample
+};
+
+// Group size the server agrees to for a requested one (0 turns parity off). Groups fit in half the
+// receive window so rcopy still holds a group's PDUs when its parity shows up
+int fec_negotiate(int requested, int window_size);
+
+// Server side: k from fec_negotiate, FEC_ADAPTIVE starts at FEC_ADAPT_START
+void fec_encoder_init(struct fec_encoder *fec, int k, int32_t buf_size, int window_size);
+
+// Folds a DATA PDU (its flag and payload) into the open group. Returns the parity PDU length (parity points at it) when the group closes, else 0
+int32_t fec_add(struct fec_encoder *fec, uint8_t flag, uint8_t *payload, int32_t payload_len, uint64_t seq_num, uint8_t **parity);
+
+// Closes a partial group early (ahead of the EOF), 0 if nothing is open
+int32_t fec_flush(struct fec_encoder *fec, uint8_t **parity);
+
+// Holes the receiver reported (SREJ/SACK), losses the parity did not cover
+void fec_loss(struct fec_encoder *fec, uint32_t lost);
+
+// Server side: gives the parity buffers back
+void fec_encoder_free(struct fec_encoder *fec);
+
+// rcopy side: parity PDUs waiting for a retransmission to bring their group down to one hole
+struct fec_decoder {
+    int enabled; // Parity was negotiated, in-order PDUs are kept in the window for rebuilding
+    int32_t slot_len; // Largest parity PDU
+    uint8_t *pending; // FEC_PENDING parity PDUs
+    int32_t pending_len[FEC_PENDING]; // 0 marks a free entry
+    uint64_t parity_next; // End of the newest group a parity PDU came in for
+    uint8_t *recovered; // Last rebuilt DATA PDU
+};
+
+// rcopy side: slot_len is the negotiated DATA PDU length
+void fec_decoder_init(struct fec_decoder *fec, int32_t slot_len);
+
+// Takes a parity PDU. Returns the length of a rebuilt DATA PDU (in fec->recovered), 0 if nothing could be rebuilt
+int32_t fec_receive(struct fec_decoder *fec, uint8_t *parity, int32_t len, struct window *w, uint64_t expected);
+
+// Tries the held parity PDUs again after more data came in, same return as fec_receive
+int32_t fec_retry(struct fec_decoder *fec, struct window *w, uint64_t expected);
+
+// Whether a held parity PDU can rebuild seq_num right now
+int fec_repairable(struct fec_decoder *fec, struct window *w, uint64_t expected, uint64_t seq_num);
+
+// Sequence numbers a parity PDU covers (its header has the low 32 bits of the first, near places them)
+void fec_group(uint8_t *parity, uint64_t near, uint64_t *start, uint32_t *count);
+
+#endif // FEC_H
@@ -19,6 +19,10 @@ extern "C" {
 #ifdef sendto
     #undef sendto
 #endif
+
+#ifdef sendmmsg
+    #undef sendmmsg
+#endif
 // ============================================================================
 #include <stdint.h>
 #include <stdio.h>
@@ -31,6 +35,8 @@ extern "C" {
 #include <string.h>
 
 #include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <vector>
 // ============================================================================
 PacketManager::PacketManager() :
     m_ErrorRate(0.0f), m_MsgNo(0)
@@ -325,6 +331,42 @@ void PacketManager::printType(int flag, char * buf)
             MSG_PRINT("  -EOF Response");
         break;
 
+		case 33:
+			memcpy(&seqNumber, &(buf[7]), 4);
+			seqNumber = ntohl(seqNumber);
+			MSG_PRINT("  -SACK #: %4u", seqNumber);
+		break;
+
+		case 34:
+			memcpy(&seqNumber, buf, 4);
+			seqNumber = ntohl(seqNumber);
+			MSG_PRINT("  -FEC parity #: %4u", seqNumber);
+		break;
+
+		case 35:
+			memcpy(&seqNumber, &(buf[7]), 4);
+			seqNumber = ntohl(seqNumber);
+			MSG_PRINT("  -Delta signatures from #: %4u", seqNumber);
+		break;
+
+		case 80:
+			memcpy(&seqNumber, buf, 4);
+			seqNumber = ntohl(seqNumber);
+			MSG_PRINT("  -Compressed data #: %4u", seqNumber);
+		break;
+
+		case 81:
+			memcpy(&seqNumber, buf, 4);
+			seqNumber = ntohl(seqNumber);
+			MSG_PRINT("  -Resent compressed data #: %4u", seqNumber);
+		break;
+
+		case 82:
+			memcpy(&seqNumber, buf, 4);
+			seqNumber = ntohl(seqNumber);
+			MSG_PRINT("  -Timeout resent compressed data #: %4u", seqNumber);
+		break;
+
 		default:
 			MSG_PRINT("  -User defined");
 		break;
@@ -436,4 +478,161 @@ ssize_t PacketManager::recvfrom_Mod(int s, void *buf, size_t len, int flags,
     return ret;
 }
 // ============================================================================
+int PacketManager::sendmmsg_Err(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+    if (msgvec == NULL)
+    {
+        ERR_PRINT("msgvec pointer == NULL\n");
+        exit(1);
+    }
+
+    // Each message gets its own copy (flattened from its iovec) so the
+    // MsgEvents can flip/drop it exactly like a single sendto_Err() call
+    std::vector< std::vector<unsigned char> > copies(vlen);
+    std::vector<struct mmsghdr> outgoing;
+    std::vector<struct iovec> iovs(vlen);
+
+    for (unsigned int i = 0; i < vlen; ++i)
+    {
+        struct msghdr *hdr = &msgvec[i].msg_hdr;
+        size_t len = 0;
+
+        for (size_t j = 0; j < hdr->msg_iovlen; ++j)
+        {
+            len += hdr->msg_iov[j].iov_len;
+        }
+
+        if (len == 0)
+        {
+            ERR_PRINT("len == 0: %u\n", i);
+            exit(1);
+        }
+
+        copies[i].resize(len);
+        size_t offset = 0;
+        for (size_t j = 0; j < hdr->msg_iovlen; ++j)
+        {
+            memcpy(&copies[i][offset], hdr->msg_iov[j].iov_base, hdr->msg_iov[j].iov_len);
+            offset += hdr->msg_iov[j].iov_len;
+        }
+
+        // Report the whole length as sent, even for dropped messages
+        msgvec[i].msg_len = len;
+
+        // A UDP_SEGMENT (GSO) message is really several datagrams, so the
+        // events run on every segment the kernel will cut it into
+        size_t segSize = len;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg))
+        {
+            if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_SEGMENT))
+            {
+                uint16_t gsoSize = 0;
+                memcpy(&gsoSize, CMSG_DATA(cmsg), sizeof(gsoSize));
+                segSize = gsoSize;
+            }
+        }
+
+        size_t kept = 0;
+        for (offset = 0; offset < len; offset += segSize)
+        {
+            size_t lenTmp = (len - offset < segSize) ? len - offset : segSize;
+            unsigned char *buf = &copies[i][offset];
+
+            ++m_MsgNo;
+
+            uint32_t seqNo = ntohl(*(uint32_t*)(buf));
+            uint8_t packetFlags = buf[6];
+            MSG_PRINT("SEND MSG# %3u SEQ# %3u LEN %4u FLAGS %2d ", m_MsgNo, seqNo, lenTmp, packetFlags);
+            printType(packetFlags, (char *)buf);
+
+            void* pBuf = buf;
+            int nResult = processEvents((void**)&pBuf, &lenTmp, m_MsgNo);
+
+            MSG_PRINT("\n");
+            if (nResult < 0)
+            {
+                ERR_PRINT("prcoessEvents\n");
+                return nResult;
+            }
+            else if ((nResult == 0) || (nResult == 1))
+            {
+                // Slide surviving segments down over any dropped ones
+                memmove(&copies[i][kept], pBuf, lenTmp);
+                kept += lenTmp;
+            }
+            // Drop Case - leave it out of the message
+        }
+
+        if (kept > 0)
+        {
+            struct mmsghdr msg = msgvec[i];
+            iovs[i].iov_base = &copies[i][0];
+            iovs[i].iov_len = kept;
+            msg.msg_hdr.msg_iov = &iovs[i];
+            msg.msg_hdr.msg_iovlen = 1;
+            outgoing.push_back(msg);
+        }
+    }
+
+    // sendmmsg() may stop short of the full vector, keep pushing the rest
+    unsigned int sent = 0;
+    while (sent < outgoing.size())
+    {
+        int nResult = sendmmsg(s, &outgoing[sent], outgoing.size() - sent, flags);
+        if (nResult < 0)
+        {
+            return nResult;
+        }
+        sent += nResult;
+    }
+
+    return vlen;
+}
+// ============================================================================
+int PacketManager::recvmmsg_Mod(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+                   struct timespec *timeout)
+{
+    int ret = ::recvmmsg(s, msgvec, vlen, flags, timeout);
+
+    // Report each datagram of the batch the same way recvfrom_Mod() does
+    for (int i = 0; i < ret; ++i)
+    {
+        struct msghdr *hdr = &msgvec[i].msg_hdr;
+        char *msgBuf = (char *) hdr->msg_iov[0].iov_base;
+        unsigned int msgLen = msgvec[i].msg_len;
+
+        // A UDP_GRO buffer holds several datagrams of gso_size each
+        unsigned int segSize = msgLen;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg))
+        {
+            if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO))
+            {
+                int groSize = 0;
+                memcpy(&groSize, CMSG_DATA(cmsg), sizeof(groSize));
+                segSize = groSize;
+            }
+        }
+
+        for (unsigned int offset = 0; offset < msgLen; offset += segSize)
+        {
+            char *buf = msgBuf + offset;
+            unsigned int len = (msgLen - offset < segSize) ? msgLen - offset : segSize;
+
+            uint32_t seqNo = ntohl(*(uint32_t*)(buf));
+            uint8_t packetFlags = buf[6];
+            MSG_PRINT("RECV          SEQ# %3u LEN %4u FLAGS %2d ", seqNo, len, packetFlags);
+            printType(packetFlags, buf);
+
+            if (in_cksum((unsigned short *) buf, len) != 0)
+            {
+                MSG_PRINT(" - RECV Corrupted packet");
+            }
+
+            MSG_PRINT("\n");
+        }
+    }
+
+    return ret;
+}
+// ============================================================================
 // ============================================================================
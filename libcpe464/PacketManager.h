@@ -48,6 +48,11 @@ class PacketManager
     ssize_t recvfrom_Mod(int s, void *buf, size_t len, int flags,
                     struct sockaddr *from, socklen_t *fromlen);
 
+    int sendmmsg_Err(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+
+    int recvmmsg_Mod(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+                    struct timespec *timeout);
+
   private:
     float      m_ErrorRate;
     uint32_t   m_MsgNo;
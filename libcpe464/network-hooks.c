@@ -21,10 +21,12 @@
 #undef select
 #undef send
 #undef sendto
+#undef sendmmsg
 
 #ifdef CPE464_OVERRIDE_RECV
     #undef recv
     #undef recvfrom
+    #undef recvmmsg
 #endif
 // ============================================================================
 #include <sys/types.h>
@@ -236,4 +238,20 @@ ssize_t recvfromErr(int s, void *buf, size_t len, int flags,
     return g_PktMgr.recvfrom_Mod(s, buf, len, flags, from, fromlen);
 }
 // ============================================================================
+int sendmmsgErr(int s, struct mmsghdr *msgvec, unsigned int vlen,
+              int flags)
+{
+    //DBG_PRINT(DBG_LEVEL_VDEBUG, "\n");
+
+    return g_PktMgr.sendmmsg_Err(s, msgvec, vlen, flags);
+}
+// ============================================================================
+int recvmmsgErr(int s, struct mmsghdr *msgvec, unsigned int vlen,
+              int flags, struct timespec *timeout)
+{
+    //DBG_PRINT(DBG_LEVEL_VDEBUG, "\n");
+
+    return g_PktMgr.recvmmsg_Mod(s, msgvec, vlen, flags, timeout);
+}
+// ============================================================================
 // ============================================================================
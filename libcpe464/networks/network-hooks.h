@@ -89,6 +89,20 @@ extern "C" {
     ssize_t recvfromErr(int s, void *buf, size_t len, int flags,
                         struct sockaddr *from, socklen_t *fromlen);
 
+    /*
+     * sendmmsgErr(...) runs every message of the vector through the same
+     * drop/flip events as sendtoErr(...). Dropped messages are still counted
+     * as sent. Messages carrying a UDP_SEGMENT cmsg are handled one segment
+     * at a time.  (Needs _GNU_SOURCE for struct mmsghdr)
+     */
+    struct mmsghdr;
+    int sendmmsgErr(int s, struct mmsghdr *msgvec, unsigned int vlen,
+                    int flags);
+
+    struct timespec;
+    int recvmmsgErr(int s, struct mmsghdr *msgvec, unsigned int vlen,
+                    int flags, struct timespec *timeout);
+
     #define socket(...)	  socketMod(__VA_ARGS__)
 	#define bind(...)     bindMod(__VA_ARGS__)
     #define select(...)   selectMod(__VA_ARGS__)
@@ -96,10 +110,12 @@ extern "C" {
 
     #define send(...)     sendErr(__VA_ARGS__)
     #define sendto(...)   sendtoErr(__VA_ARGS__)
+    #define sendmmsg(...) sendmmsgErr(__VA_ARGS__)
 
 #ifdef CPE464_OVERRIDE_RECV
     #define recv(...)     recvErr(__VA_ARGS__)
     #define recvfrom(...) recvfromErr(__VA_ARGS__)
+    #define recvmmsg(...) recvmmsgErr(__VA_ARGS__)
 #endif
 
     #define sendtoErr_init(...) sendErr_init(__VA_ARGS__)
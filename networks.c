@@ -177,6 +177,41 @@ int udpServerSetup(int serverPort)
 	
 }
 
+// Same as udpServerSetup, but with SO_REUSEPORT set before the bind so several sockets can share
+// the port (the kernel hashes each client to one of them). Doesn't print, returns the socket number.
+
+int udpServerSetupReuse(int serverPort)
+{
+	struct sockaddr_in6 serverAddress;
+	int socketNum = 0;
+	int on = 1;
+	
+	if ((socketNum = socket(AF_INET6,SOCK_DGRAM,0)) < 0)
+	{
+		perror("socket() call error");
+		exit(-1);
+	}
+
+	if (setsockopt(socketNum, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+	{
+		perror("SO_REUSEPORT");
+		exit(-1);
+	}
+	
+	memset(&serverAddress, 0, sizeof(struct sockaddr_in6));
+	serverAddress.sin6_family = AF_INET6;
+	serverAddress.sin6_addr = in6addr_any;
+	serverAddress.sin6_port = htons(serverPort);   // if 0 = os picks 
+
+	if (bind(socketNum,(struct sockaddr *) &serverAddress, sizeof(serverAddress)) < 0)
+	{
+		perror("bind() call error");
+		exit(-1);
+	}
+
+	return socketNum;
+}
+
 // This function opens a socket and fills in the serverAdress structure using the hostName and serverPort.  
 // It assumes the address structure is created before calling this.
 // Returns the socket number and the filled in serverAddress struct.
@@ -223,4 +258,29 @@ int safeGetUdpSocket()
 	return socketNum;
 }
 
+// Path MTU the kernel has for address (route MTU, lowered by any ICMP too-big seen), 0 if unknown
+int getPathMtu(struct sockaddr_in6 *address)
+{
+	int mtu = 0;
+	int pmtud = IPV6_PMTUDISC_DO;
+	socklen_t mtuLen = sizeof(mtu);
+	int socketNum = socket(AF_INET6, SOCK_DGRAM, 0);
 
+	if (socketNum < 0)
+	{
+		return 0;
+	}
+
+	// Connecting picks the route, DO makes the kernel report the real MTU instead of fragmenting
+	setsockopt(socketNum, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &pmtud, sizeof(pmtud));
+
+	if ((connect(socketNum, (struct sockaddr *) address, sizeof(*address)) < 0)
+		|| (getsockopt(socketNum, IPPROTO_IPV6, IPV6_MTU, &mtu, &mtuLen) < 0))
+	{
+		mtu = 0;
+	}
+
+	close(socketNum);
+
+	return mtu;
+}
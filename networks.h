@@ -36,7 +36,9 @@ int tcpClientSetup(char * serverName, char * serverPort, int debugFlag);
 
 // For UDP Server and Client
 int udpServerSetup(int serverPort);
+int udpServerSetupReuse(int serverPort);
 int setupUdpClientToServer(struct sockaddr_in6 *serverAddress, char * hostName, int serverPort);
 int safeGetUdpSocket();
+int getPathMtu(struct sockaddr_in6 *address);
 
 #endif
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "pace.h"
+#include "rtt.h"
+
+static void pacer_refill(struct pacer *pace);
+
+// rate 0 derives the rate from the delivery rate, burst_bytes sets the bucket depth
+void pacer_init(struct pacer *pace, double rate, double burst_bytes) {
+    pace->rate = rate;
+    pace->auto_rate = (rate == 0);
+    pace->burst = burst_bytes;
+    pace->tokens = burst_bytes;
+    pace->last = rtt_now();
+    pace->delivery_rate = 0;
+    pace->delivered = 0;
+    pace->sample_start = pace->last;
+}
+
+// Microseconds until len bytes may be sent, 0 if they can go now
+int64_t pacer_delay(struct pacer *pace, int32_t len) {
+    if (pace->rate == 0) {
+        return 0;
+    }
+
+    pacer_refill(pace);
+
+    if (pace->tokens >= len) {
+        return 0;
+    }
+
+    int64_t delay = (int64_t)((len - pace->tokens) * 1000000.0 / pace->rate);
+    return (delay > 0) ? delay : 1;
+}
+
+// Takes len bytes worth of tokens for a PDU that was sent
+void pacer_consume(struct pacer *pace, int32_t len) {
+    // Goes negative when unpaced, refill starts from zero once a rate shows up
+    pace->tokens -= len;
+    if (pace->tokens < 0 && pace->rate == 0) {
+        pace->tokens = 0;
+    }
+}
+
+// Feeds acked bytes into the delivery rate (samples last at least one srtt)
+void pacer_delivered(struct pacer *pace, int64_t bytes, int64_t srtt) {
+    int64_t now = rtt_now();
+    int64_t interval = now - pace->sample_start;
+
+    pace->delivered += bytes;
+
+    if (srtt < PACE_MIN_INTERVAL) {
+        srtt = PACE_MIN_INTERVAL;
+    }
+    if (interval < srtt) {
+        return;
+    }
+
+    double sample = pace->delivered * 1000000.0 / interval;
+    if (pace->delivery_rate == 0) {
+        pace->delivery_rate = sample;
+    }
+    else {
+        pace->delivery_rate = (7 * pace->delivery_rate + sample) / 8;
+    }
+
+    pace->delivered = 0;
+    pace->sample_start = now;
+
+    if (pace->auto_rate) {
+        pacer_refill(pace); // Credit the elapsed time at the old rate first
+        pace->rate = PACE_GAIN * pace->delivery_rate;
+    }
+}
+
+static void pacer_refill(struct pacer *pace) {
+    int64_t now = rtt_now();
+
+    pace->tokens += (now - pace->last) * pace->rate / 1000000.0;
+    if (pace->tokens > pace->burst) {
+        pace->tokens = pace->burst;
+    }
+    pace->last = now;
+}
@@ -0,0 +1,34 @@
+#ifndef PACE_H
+#define PACE_H
+
+#include <stdint.h>
+
+#define PACE_BURST_PDUS 4 // Bucket depth in PDUs, the largest back-to-back burst
+#define PACE_GAIN 1.25 // Auto rate runs this far above the measured delivery rate so it can grow
+#define PACE_MIN_INTERVAL 1000 // Shortest delivery rate sample (microseconds)
+
+// Token bucket pacer, rates in bytes per second and times in microseconds
+struct pacer {
+    double rate; // Pacing rate, 0 means unpaced (auto mode before the first sample)
+    double tokens; // Bytes that may go out right now
+    double burst; // Bucket depth
+    int64_t last; // Last refill
+    int auto_rate; // Rate follows the measured delivery rate
+    double delivery_rate; // Smoothed delivery rate
+    int64_t delivered; // Bytes acked in the current sample
+    int64_t sample_start; // When the current sample began
+};
+
+// rate 0 derives the rate from the delivery rate, burst_bytes sets the bucket depth
+void pacer_init(struct pacer *pace, double rate, double burst_bytes);
+
+// Microseconds until len bytes may be sent, 0 if they can go now
+int64_t pacer_delay(struct pacer *pace, int32_t len);
+
+// Takes len bytes worth of tokens for a PDU that was sent
+void pacer_consume(struct pacer *pace, int32_t len);
+
+// Feeds acked bytes into the delivery rate (samples last at least one srtt)
+void pacer_delivered(struct pacer *pace, int64_t bytes, int64_t srtt);
+
+#endif // PACE_H
@@ -7,6 +7,7 @@
 #include "gethostbyname.h"
 #include "networks.h"
 #include "safeUtil.h"
+#include "pdu.h"
 
 #define MAXPDUBUF 1407
 
@@ -28,8 +29,8 @@
 
 
 // Adds PDU application level header to payload
-int createPDU(uint8_t *pduBuffer, uint32_t sequenceNumber, uint8_t flag, uint8_t *payload, int payloadLen) {
-    uint32_t net_seq = htonl(sequenceNumber); // Convert sequence number to network order (using htonl for 32-bit)
+int createPDU(uint8_t *pduBuffer, uint64_t sequenceNumber, uint8_t flag, uint8_t *payload, int payloadLen) {
+    uint32_t net_seq = htonl((uint32_t)sequenceNumber); // Low 32 bits in network order, the receiver expands them with seq_expand
 
     // Build pduBuffer
     memcpy(pduBuffer, &net_seq, seqNumLen); // Copy sequence number into buffer (Network Order)
@@ -47,6 +48,42 @@ int createPDU(uint8_t *pduBuffer, uint32_t sequenceNumber, uint8_t flag, uint8_t
     return pduLength;
 }
 
+// Checksum of a PDU whose header (checksum field zeroed) and payload sit apart. The flag byte pairs
+// with the first payload byte, the rest of the payload is summed from its second byte on
+uint16_t pdu_cksum(uint8_t *header, uint8_t *payload, int payloadLen) {
+    uint8_t pair[2] = {header[seqNumLen + chkSumLen], 0};
+    uint16_t word = 0;
+    uint32_t sum = (uint16_t)~in_cksum((unsigned short *)header, seqNumLen + chkSumLen);
+
+    if (payloadLen > 0) {
+        pair[1] = payload[0];
+        sum += (uint16_t)~in_cksum((unsigned short *)(payload + 1), payloadLen - 1);
+    }
+
+    memcpy(&word, pair, 2);
+    sum += word;
+
+    // Fold the carries back in, same as in_cksum
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += (sum >> 16);
+
+    return (uint16_t)~sum;
+}
+
+// Builds just the header for a payload left where it is (sent gathered with it), returns the PDU length
+int createPDUHeader(uint8_t *header, uint64_t sequenceNumber, uint8_t flag, uint8_t *payload, int payloadLen) {
+    uint32_t net_seq = htonl((uint32_t)sequenceNumber);
+
+    memcpy(header, &net_seq, seqNumLen);
+    memset(header + seqNumLen, 0, chkSumLen);
+    memcpy(header + seqNumLen + chkSumLen, &flag, flagLen);
+
+    uint16_t checksum = pdu_cksum(header, payload, payloadLen);
+    memcpy(header + seqNumLen, &checksum, chkSumLen);
+
+    return seqNumLen + chkSumLen + flagLen + payloadLen;
+}
+
 // Print general PDU
 void printPDU(uint8_t * PDU, int pduLength) {
     
@@ -159,7 +196,7 @@ void printPacket(uint8_t * PDU, int pduLength) {
 }
 
 // Send initial Filename/Establishment packet
-int send_init(uint8_t *buf, int fileNameLen, struct Connection * server, uint8_t flag, uint32_t *clientSeqNum, uint8_t *packet) {
+int send_init(uint8_t *buf, int fileNameLen, struct Connection * server, uint8_t flag, uint64_t *clientSeqNum, uint8_t *packet) {
     int payloadLen = 4 + 4 + fileNameLen; // Calculate payload length
     int packetLen = 7 + payloadLen;
     
@@ -180,7 +217,7 @@ int send_init(uint8_t *buf, int fileNameLen, struct Connection * server, uint8_t
 }
 
 // Send general packets (Data, RRs, and SREJs)
-int send_buf(uint8_t *data, int dataLen, struct Connection * server, uint8_t flag, uint32_t *clientSeqNum, uint8_t *packet) 
+int send_buf(uint8_t *data, int dataLen, struct Connection * server, uint8_t flag, uint64_t *clientSeqNum, uint8_t *packet) 
 {
     int packetLen = 7 + dataLen;
     createPDU(packet, *clientSeqNum, flag, data, dataLen);
@@ -192,17 +229,42 @@ int send_buf(uint8_t *data, int dataLen, struct Connection * server, uint8_t fla
     
 }
 
+// Full sequence number a 32-bit wire value stands for: the one closest to near. Everything
+// in flight is within half the wire space of the receiver's window, so this never guesses wrong
+uint64_t seq_expand(uint32_t wire, uint64_t near) {
+    uint64_t seq = (near & ~(SEQ_WIRE_SPAN - 1)) | wire;
+
+    if (seq + SEQ_WIRE_SPAN / 2 < near) {
+        seq += SEQ_WIRE_SPAN;
+    }
+    else if ((seq > near + SEQ_WIRE_SPAN / 2) && (seq >= SEQ_WIRE_SPAN)) {
+        seq -= SEQ_WIRE_SPAN;
+    }
+
+    return seq;
+}
+
+// Pull sequence number (its low 32 bits) and flag out of a received PDU (PDU_COMPRESSED stays in the PDU, flag is just the type)
+void getHeader(uint8_t *pdu, uint8_t *flag, uint32_t *seq_num) {
+    memcpy(seq_num, pdu, seqNumLen);
+    memcpy(flag, pdu + seqNumLen + chkSumLen, flagLen);
+    *flag &= ~PDU_COMPRESSED;
+
+    *seq_num = ntohl(*seq_num);
+}
+
 // Receive all forms of packets
 int recv_buf(uint8_t *buf, int packetLen, int serverSocketNumber, struct Connection *client, uint8_t *flag, uint32_t *clientSeqNum) {
     struct sockaddr_storage clientAddr;
     int clientAddrLen = sizeof(clientAddr);
 
-    int recvLen = safeRecvfrom(serverSocketNumber, buf, MAXPDUBUF, 0, (struct sockaddr *)&clientAddr, &clientAddrLen);
+    int recvLen = safeRecvfrom(serverSocketNumber, buf, packetLen, 0, (struct sockaddr *)&clientAddr, &clientAddrLen);
 
     // Store the client's address in the client structure
     memcpy(&client->address, &clientAddr, clientAddrLen);
     memcpy(clientSeqNum, buf, 4);
     memcpy(flag, buf + 6, 1);
+    *flag &= ~PDU_COMPRESSED;
 
     *clientSeqNum = ntohl(*clientSeqNum);
 
@@ -217,4 +279,36 @@ int recv_buf(uint8_t *buf, int packetLen, int serverSocketNumber, struct Connect
 
 
     return recvLen;
-}
\ No newline at end of file
+}
+// Appends a type/length/value option to a handshake payload, returns the new options length
+int init_opt_add(uint8_t *opts, int optsLen, uint8_t type, void *value, uint16_t len) {
+    uint16_t net_len = htons(len);
+
+    opts[optsLen] = type;
+    memcpy(opts + optsLen + 1, &net_len, 2);
+    memcpy(opts + optsLen + 3, value, len);
+
+    return optsLen + 3 + len;
+}
+
+// Finds an option in a handshake payload, NULL if it isn't there (or runs past the end)
+uint8_t *init_opt_find(uint8_t *opts, int optsLen, uint8_t type, uint16_t *len) {
+    int offset = 0;
+
+    while (offset + 3 <= optsLen) {
+        uint16_t net_len = 0;
+        memcpy(&net_len, opts + offset + 1, 2);
+        *len = ntohs(net_len);
+
+        if (offset + 3 + *len > optsLen) {
+            return NULL;
+        }
+        if (opts[offset] == type) {
+            return opts + offset + 3;
+        }
+
+        offset += 3 + *len;
+    }
+
+    return NULL;
+}
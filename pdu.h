@@ -16,6 +16,13 @@
 #define chkSumLen 2
 #define flagLen 1
 
+#define PDU_HEADER_LEN 7
+#define START_SEQ_NUM 1 // First DATA PDU
+#define SEQ_WIRE_SPAN ((uint64_t)1 << 32) // Sequence numbers are 64 bits, headers and ack payloads carry the low 32
+#define MAX_PAYLOAD 65000 // Largest negotiable buffer size, a full PDU still fits one UDP datagram
+#define FEC_HEADER_LEN 4 // Parity payload: group size (2), XOR of the payload lengths (2), then the XOR itself
+#define MAX_PDU (PDU_HEADER_LEN + FEC_HEADER_LEN + MAX_PAYLOAD) // Largest datagram, a parity PDU over full payloads
+
 #define FNAME_BAD 7
 #define FNAME_OK 9
 #define DATA 16
@@ -26,14 +33,32 @@
 #define DATA_TIMEOUT 18
 #define SREJ 6
 #define SREJ_RETRAN 17
+#define SACK 33 // Cumulative ack + bitmap of PDUs received past it
+#define FEC_PARITY 34 // XOR over a group of DATA payloads, rcopy rebuilds one lost PDU per group from it
+#define DELTA_SIG 35 // Block signatures of rcopy's old file (rcopy to server), RR'd with the next index wanted
+#define PDU_COMPRESSED 0x40 // Or'd into DATA/SREJ_RETRAN/DATA_TIMEOUT: the payload is the chunk, raw deflated
+
+// FILENAME_INIT/FNAME_OK options: after the file name (NUL terminated) or the buffer size, type (1) length (2) value
+#define INIT_OPT_FEC 1 // FEC group size (2 bytes), FEC_ADAPTIVE lets the server choose
+#define INIT_OPT_STRIPE 2 // Stripe index and stripe count (2 bytes each): send only PDUs index, index + count, ...
+#define INIT_OPT_RESUME 3 // Byte offset already on disk (8) and a bitmap of chunks past it: send only the rest
+#define INIT_OPT_DELTA 4 // Block size and block count (4 bytes each) of rcopy's old file: send a delta against it
+#define INIT_OPT_COMPRESS 5 // Compression level (1 byte): DATA payloads that shrink go compressed
+#define INIT_OPT_WINDOW 6 // FNAME_OK only: window size (4 bytes) the server settled on, rcopy's may have been too big
 
 
 
-int createPDU(uint8_t *pduBuffer, uint32_t sequenceNumber, uint8_t flag, uint8_t *payload, int payloadLen);
+int createPDU(uint8_t *pduBuffer, uint64_t sequenceNumber, uint8_t flag, uint8_t *payload, int payloadLen);
+int createPDUHeader(uint8_t *header, uint64_t sequenceNumber, uint8_t flag, uint8_t *payload, int payloadLen);
+uint16_t pdu_cksum(uint8_t *header, uint8_t *payload, int payloadLen);
 void printPDU(uint8_t * PDU, int pduLength);
 void printPacket(uint8_t * PDU, int pduLength);
-int send_init(uint8_t *buf, int dataLen, struct Connection * server, uint8_t flag, uint32_t *clientSeqNum, uint8_t *packet);
+int send_init(uint8_t *buf, int dataLen, struct Connection * server, uint8_t flag, uint64_t *clientSeqNum, uint8_t *packet);
 int recv_buf(uint8_t *buf, int packetLen, int serverSocketNumber, struct Connection * client, uint8_t *flag, uint32_t *clientSeqNum);
-int send_buf(uint8_t *data, int dataLen, struct Connection * server, uint8_t flag, uint32_t *clientSeqNum, uint8_t *packet);
+void getHeader(uint8_t *pdu, uint8_t *flag, uint32_t *seq_num);
+int init_opt_add(uint8_t *opts, int optsLen, uint8_t type, void *value, uint16_t len);
+uint8_t *init_opt_find(uint8_t *opts, int optsLen, uint8_t type, uint16_t *len);
+int send_buf(uint8_t *data, int dataLen, struct Connection * server, uint8_t flag, uint64_t *clientSeqNum, uint8_t *packet);
+uint64_t seq_expand(uint32_t wire, uint64_t near);
 
 #endif
\ No newline at end of file
@@ -11,9 +11,12 @@
 //
 // This is for student projects so I don't intend on improving this. 
 
+#define _GNU_SOURCE
+
 #include <poll.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "safeUtil.h"
 #include "pollLib.h"
@@ -25,6 +28,7 @@ static int maxFileDescriptor = 0;
 static int currentPollSetSize = 0;
 
 static void growPollSet(int newSetSize);
+static int readySocket(int pollValue);
 
 // Poll functions (setup, add, remove, call)
 void setupPollSet()
@@ -68,8 +72,6 @@ int pollCall(int timeInMilliSeconds)
 	// (this -1 is a feature of poll)
 	// If timeInMilliSeconds == 0 it will return immediately after looking at the poll set
 	
-	int i = 0;
-	int returnValue = -1;
 	int pollValue = 0;
 	
 	if ((pollValue = poll(pollFileDescriptors, maxFileDescriptor, timeInMilliSeconds)) < 0)
@@ -78,6 +80,37 @@ int pollCall(int timeInMilliSeconds)
 		exit(-1);
 	}	
 			
+	// Ready socket # or -1 if timeout/none
+	return readySocket(pollValue);
+}
+
+int pollCallMicro(long timeInMicroSeconds)
+{
+	// Same as pollCall() but with microsecond resolution (uses ppoll())
+	// so timeouts below a millisecond are not rounded away
+	// if timeInMicroSeconds < 0 blocks forever (until a socket ready)
+	
+	int pollValue = 0;
+	struct timespec timeout;
+	
+	timeout.tv_sec = timeInMicroSeconds / 1000000;
+	timeout.tv_nsec = (timeInMicroSeconds % 1000000) * 1000;
+	
+	if ((pollValue = ppoll(pollFileDescriptors, maxFileDescriptor, (timeInMicroSeconds < 0) ? NULL : &timeout, NULL)) < 0)
+	{
+		perror("pollCallMicro");
+		exit(-1);
+	}	
+			
+	// Ready socket # or -1 if timeout/none
+	return readySocket(pollValue);
+}
+
+static int readySocket(int pollValue)
+{
+	int i = 0;
+	int returnValue = -1;
+	
 	// check to see if timeout occurred (poll returned 0)
 	if (pollValue > 0)
 	{
@@ -97,7 +130,6 @@ int pollCall(int timeInMilliSeconds)
 
 	}
 	
-	// Ready socket # or -1 if timeout/none
 	return returnValue;
 }
 
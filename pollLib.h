@@ -17,5 +17,6 @@ void setupPollSet();
 void addToPollSet(int socketNumber);
 void removeFromPollSet(int socketNumber);
 int pollCall(int timeInMilliSeconds);
+int pollCallMicro(long timeInMicroSeconds);
 
 #endif
\ No newline at end of file
@@ -7,10 +7,12 @@
 #include <sys/stat.h>
 #include <sys/uio.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <strings.h>
+#include <limits.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -21,36 +23,123 @@
 #include "pdu.h"
 #include "pollLib.h"
 #include "window.h"
+#include "batch.h"
+#include "rtt.h"
+#include "fec.h"
+#include "resume.h"
+#include "delta.h"
+#include "compress.h"
+#include "uring.h"
 
 #define MAXBUF 1400
 #define MAXPDUBUF 1407
 #define MAXFILELEN 100
 #define MAXWINDOW 1073741824
 #define MAX_RETRANS 10
-#define START_SEQ_NUM 1
+#define RECV_TIMEOUT -2
+#define RECV_GIVE_UP -3
+#define RECV_ACK_DUE -4
+#define RECV_FEC_MISS -5 // Parity for the hole at expected came in and couldn't fill it
+#define ACK_DELAY_DEFAULT 2 // ms a held-back RR may wait with -a
+#define MAX_STRIPES 64
+#define FEC_WAIT_DIV 2 // A hole waits srtt / FEC_WAIT_DIV for its parity PDU before it is reported
+#define FLUSH_MAX_IOV 1024 // IOV_MAX: held PDUs one pwritev() takes at most
+
+// Optional transfer modes selected on the command line
+struct RcopyOptions
+{
+	int batch; // -b: drain the socket with one recvmmsg() per wakeup
+	int gro; // -g: let the kernel coalesce PDUs with UDP_GRO and split them here
+	int64_t rto_min; // -r: RTO floor (microseconds)
+	int64_t rto_max; // -R: RTO ceiling (microseconds)
+	int sack; // -k: report holes with one SACK bitmap instead of SREJ/RR pairs
+	int ack_every; // -a: RR every N in-order PDUs (1 acks each one)
+	int64_t ack_delay; // -d: longest an RR is held back (microseconds)
+	int fec; // -f: parity group size asked for (FEC_ADAPTIVE lets the server pick), 0 is off
+	int stripes; // -n: interleaved sub-sessions the file is split over, one process each
+	int stripe; // Which of them this process receives
+	int resume; // -c: keep what an earlier attempt wrote and only fetch the rest
+	int delta; // -D: only fetch what differs from the existing to-filename
+	int compress; // -z: ask for deflated payloads
+	int uring; // -u: queue disk writes through io_uring instead of making them on the receive path
+};
+
+static struct RcopyOptions options;
+
+// In-order RRs held back by -a/-d
+struct AckState
+{
+	int unacked; // In-order PDUs not acked yet
+	uint64_t ack_seq; // RR value owed for them
+	int64_t deadline; // Send it by then even if fewer than ack_every arrived
+};
+
+static struct AckState ackState;
+
+// Parity held for rebuilding lost PDUs with -f
+static struct fec_decoder fecDec;
+static int64_t fecDeadline; // A hole waiting on its parity gets reported by then, 0 if none is waiting
+
+// Chunks on disk with -c, checkpointed next to the output file
+static struct resume resume;
+
+// Old file's signatures and the new file being built from the delta with -D
+static struct delta_decoder delta;
+
+// Inflates the payloads the server compressed with -z
+static struct decompressor zip;
+
+// PDUs past a hole are written to their place in the file as they come, the window only keeps a bit for each.
+// Not for a delta (its records apply in order), -f (parity XORs against the PDUs held) or before the buffer
+// size is certain (the offsets come from it)
+static int placing;
+
+// Output file writes in flight with -u
+static struct disk_ring ring;
 
+// End of what is written in order, the next in-order payload goes here
+static off_t appended;
+
+// Window the server agreed to: window-size until FNAME_OK echoes a smaller one
+static int32_t agreedWindow;
 
 typedef enum State STATE;
 
 enum State
 {
-	START_STATE, DONE, FILENAME, WAIT_FILE_ACK, FILE_OK, RECV_DATA, BUFFER, FLUSH
+	START_STATE, DONE, FILENAME, WAIT_FILE_ACK, FILE_OK, DELTA_SIGS, RECV_DATA, BUFFER, FLUSH
 };
 
 void talkToServer(int socketNum, struct sockaddr_in6 * server);
 int readFromStdin(char * buffer);
 void checkArgs(int argc, char * argv[]);
+void printUsage();
 void processFile (char * argv[]);
-STATE filename (char * fname, int32_t buf_size, struct Connection * server);
-STATE processSelect(struct Connection *connection, int *retryCount, STATE TimeoutState, STATE DataState, STATE DoneState);
-STATE file_ok(int * outputFileFd, char *outputFileName, struct window *clientWindow, int32_t window_size);
-STATE recv_data(int32_t output_file, struct Connection * server, uint32_t * clientSeqNum, struct window *clientWindow, uint32_t *expected,  uint32_t *highest, uint32_t *data_packet_len, uint32_t *final_packet_len, uint32_t *final_packet_seq, uint32_t *eof_seq);
-STATE buffer(int32_t output_file, struct Connection * server, uint32_t * clientSeqNum, struct window *clientWindow, uint32_t *expected, uint32_t *highest, uint32_t *data_packet_len, uint32_t *final_packet_len, uint32_t *final_packet_seq, uint32_t *eof_seq);
-STATE flush(int32_t output_file, struct Connection * server, uint32_t * clientSeqNum, struct window *clientWindow, uint32_t *expected, uint32_t *highest, uint32_t *data_packet_len, uint32_t *final_packet_len, uint32_t *final_packet_seq, uint32_t *eof_seq);
-void writeDisk(int outputFileFd, uint32_t packet_len, uint8_t *packet, struct window *clientWindow, uint32_t seq_num);
-
-
-STATE start_state(char ** argv, struct Connection * server, uint32_t * clientSeqNum, uint32_t *data_packet_len) 
+void processStripes (char * argv[]);
+STATE filename (char * fname, int32_t buf_size, struct Connection * server, int64_t init_time, struct rtt *rtt, uint32_t *data_packet_len);
+STATE processSelect(struct Connection *connection, int *retryCount, STATE TimeoutState, STATE DataState, STATE DoneState, struct rtt *rtt);
+STATE file_ok(int * outputFileFd, char *outputFileName, struct window *clientWindow, int32_t window_size, uint32_t slot_len);
+STATE recv_data(int32_t output_file, struct Connection * server, uint64_t * clientSeqNum, struct window *clientWindow, uint64_t *expected,  uint64_t *highest, uint32_t *data_packet_len, uint32_t *final_packet_len, uint64_t *final_packet_seq, uint64_t *eof_seq, struct batch *rxBatch, struct rtt *rtt);
+STATE buffer(int32_t output_file, struct Connection * server, uint64_t * clientSeqNum, struct window *clientWindow, uint64_t *expected, uint64_t *highest, uint32_t *data_packet_len, uint32_t *final_packet_len, uint64_t *final_packet_seq, uint64_t *eof_seq, struct batch *rxBatch, struct rtt *rtt);
+int32_t recv_pdu(struct Connection * server, struct batch *rxBatch, uint8_t **pdu, uint8_t *flag, uint64_t *seq_num, struct rtt *rtt, struct window *clientWindow, uint64_t expected);
+int32_t wait_pdu(struct rtt *rtt, int *timeouts);
+void ack_queue(struct Connection * server, uint64_t * clientSeqNum, uint64_t ack_seq, int now);
+void ack_flush(struct Connection * server, uint64_t * clientSeqNum);
+void fec_hold(struct rtt *rtt);
+void checkpoint(int32_t output_file, struct window *clientWindow, uint64_t expected, uint64_t highest);
+void hold(int32_t output_file, struct window *clientWindow, uint64_t seq_num, uint8_t flag, uint8_t *data_buf, int32_t data_len);
+void release(int32_t output_file, struct window *clientWindow, uint64_t seq_num);
+uint64_t release_run(int32_t output_file, struct window *clientWindow, uint64_t seq_num, uint64_t last);
+void transfer_done(int32_t output_file, struct window *clientWindow, uint64_t eof_seq);
+STATE send_sigs(struct Connection * server, uint64_t * clientSeqNum, struct rtt *rtt);
+STATE flush(int32_t output_file, struct Connection * server, uint64_t * clientSeqNum, struct window *clientWindow, uint64_t *expected, uint64_t *highest, uint32_t *data_packet_len, uint32_t *final_packet_len, uint64_t *final_packet_seq, uint64_t *eof_seq, struct rtt *rtt);
+void send_sack(struct Connection * server, uint64_t * clientSeqNum, struct window *clientWindow, uint64_t expected);
+void writeDisk(int outputFileFd, uint32_t packet_len, uint8_t *packet, struct window *clientWindow, uint64_t seq_num);
+void write_at(int outputFileFd, uint8_t *data, int32_t len, off_t offset);
+void disk_done(void);
+
+
+STATE start_state(char ** argv, struct Connection * server, uint64_t * clientSeqNum, uint32_t *data_packet_len, struct batch *rxBatch, int64_t *init_time) 
 {
 	uint8_t packet[MAXPDUBUF]; // Includes PDU header and data payload (1407)
 	uint8_t buf[MAXBUF]; // Includes data payload (1400)
@@ -86,6 +175,24 @@ STATE start_state(char ** argv, struct Connection * server, uint32_t * clientSeq
 		addToPollSet(socketNum);
 		server->sk_num = socketNum; // Set socket number
 
+		// Coalesced receive only works on top of the batch slots
+		if (options.gro)
+		{
+			batch_enable_gro(rxBatch, socketNum);
+		}
+
+		// A burst past a hole is written out PDU by PDU as it comes, the socket has to hold a window's worth
+		// meanwhile (the kernel caps this at net.core.rmem_max). Only ever grown, a small window keeps the default
+		int64_t rcvbuf = (int64_t)atoi(argv[3]) * ((atoi(argv[4]) > 0) ? PDU_HEADER_LEN + atoi(argv[4]) : MAX_PDU);
+		int rcvbufLen = 0;
+		socklen_t optLen = sizeof(rcvbufLen);
+		getsockopt(socketNum, SOL_SOCKET, SO_RCVBUF, &rcvbufLen, &optLen);
+		if (rcvbuf > rcvbufLen / 2)
+		{
+			rcvbufLen = (rcvbuf > INT_MAX / 2) ? INT_MAX / 2 : (int)rcvbuf;
+			setsockopt(socketNum, SOL_SOCKET, SO_RCVBUF, &rcvbufLen, sizeof(rcvbufLen));
+		}
+
 		// Retrieve establishment variables
 		bufferSize = htonl(atoi(argv[4])); // Convert buffer size to network order
 		*data_packet_len = 7 + atoi(argv[4]);
@@ -97,8 +204,48 @@ STATE start_state(char ** argv, struct Connection * server, uint32_t * clientSeq
 		memcpy(buf, &bufferSize, 4);
 		memcpy(buf + 4, &windowSize, 4);
 		memcpy(buf + 8, argv[1], fileNameLen);
+
+		// Options ride after the file name's NUL
+		if (options.fec || (options.stripes > 1) || options.resume || delta.active || zip.active)
+		{
+			uint8_t *opts = buf + 9 + fileNameLen;
+			int optsLen = 0;
+			buf[8 + fileNameLen] = '\0';
+
+			if (options.fec)
+			{
+				uint16_t net_k = htons(options.fec);
+				optsLen = init_opt_add(opts, optsLen, INIT_OPT_FEC, &net_k, sizeof(net_k));
+			}
+			if (options.stripes > 1)
+			{
+				uint16_t net_stripe[2] = {htons(options.stripe), htons(options.stripes)};
+				optsLen = init_opt_add(opts, optsLen, INIT_OPT_STRIPE, net_stripe, sizeof(net_stripe));
+			}
+			if (options.resume)
+			{
+				uint8_t value[RESUME_HEADER_LEN + RESUME_MAX_BITS / 8];
+				int valueLen = resume_encode(&resume, atoi(argv[4]), value);
+				optsLen = init_opt_add(opts, optsLen, INIT_OPT_RESUME, value, valueLen);
+			}
+			if (delta.active)
+			{
+				uint32_t net_delta[2] = {htonl(delta.block_size), htonl(delta.block_count)};
+				optsLen = init_opt_add(opts, optsLen, INIT_OPT_DELTA, net_delta, sizeof(net_delta));
+			}
+			if (zip.active)
+			{
+				uint8_t level = COMPRESS_LEVEL;
+				optsLen = init_opt_add(opts, optsLen, INIT_OPT_COMPRESS, &level, sizeof(level));
+			}
+
+			fileNameLen += 1 + optsLen;
+		}
 		
 		send_init(buf, fileNameLen, server, flag, clientSeqNum, packet);
+
+		// Every FILENAME_INIT goes out on a fresh socket, so whatever answers on it answers this one
+		*init_time = rtt_now();
 		
         (*clientSeqNum)++; // Increment sequence number
 
@@ -115,6 +262,27 @@ int main (int argc, char *argv[])
 
 	checkArgs(argc, argv);	
 
+	if (options.stripes > 1)
+	{
+		processStripes(argv);
+	}
+
+	if (options.resume)
+	{
+		resume_load(&resume, argv[2], atoi(argv[4]));
+	}
+
+	// Nothing to diff against is a plain transfer
+	if (options.delta && (delta_signatures(&delta, argv[2]) < 0))
+	{
+		delta.active = 0;
+	}
+
+	if (options.compress && (decompress_init(&zip) < 0))
+	{
+		printf("Compression unavailable, fetching uncompressed\n");
+	}
+
 	sendErr_init(atof(argv[5]), DROP_ON, FLIP_ON, DEBUG_ON, RSEED_ON); // Set error rate
 		
 	processFile(argv);
@@ -123,21 +291,83 @@ int main (int argc, char *argv[])
 }
 
 
+// Forks one receiver per stripe and waits for all of them, each writes its own PDUs in place.
+// Returns in the child (options.stripe set), exits in the parent
+void processStripes (char * argv[])
+{
+	int failed = 0;
+	int status = 0;
+	pid_t pid = 0;
+
+	// Truncate once up front, the stripes only ever write into it
+	int fd = open(argv[2], O_CREAT | O_TRUNC | O_WRONLY, 0600);
+	if (fd < 0)
+	{
+		perror("Error on open of output file: ");
+		exit(1);
+	}
+	close(fd);
+
+	for (int i = 0; i < options.stripes; i++)
+	{
+		if ((pid = fork()) < 0)
+		{
+			perror("fork");
+			exit(1);
+		}
+
+		if (pid == 0)
+		{
+			options.stripe = i;
+			return;
+		}
+	}
+
+	while (wait(&status) > 0)
+	{
+		if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+			failed++;
+	}
+
+	if (failed != 0)
+	{
+		printf("%d of %d stripes failed\n", failed, options.stripes);
+		exit(1);
+	}
+
+	exit(0);
+}
+
+
 void processFile (char * argv[]) {
 	struct Connection *server = (struct Connection *) calloc(1, sizeof(struct Connection));
-	uint32_t clientSeqNum = 0;
+	uint64_t clientSeqNum = 0;
 	int32_t output_file_fd = 0;
 	STATE state = START_STATE; // Start State
 	struct window *clientWindow = (struct window *) calloc(1, sizeof(struct window));
-	uint32_t expected = 1;
-	uint32_t highest = 1;
+	uint64_t expected = START_SEQ_NUM;
+	uint64_t highest = START_SEQ_NUM;
 
 
 	uint32_t data_packet_len = 0;
 	uint32_t final_packet_len = 0;
-	uint32_t final_packet_seq = 0;
-	uint32_t eof_seq = 0;
+	uint64_t final_packet_seq = 0;
+	uint64_t eof_seq = 0;
+	struct batch rxBatch;
+	struct rtt rtt;
+	int64_t init_time = 0;
+
+	rtt_init(&rtt, options.rto_min, options.rto_max);
 
+	// Room to drain a full window per wakeup, GRO slots hold up to 64KB of PDUs each
+	if (options.gro)
+	{
+		batch_create_recv(&rxBatch, MAX_GRO_BATCH, GRO_SLOT_LEN);
+	}
+	else if (options.batch)
+	{
+		batch_create_recv(&rxBatch, atoi(argv[3]), (atoi(argv[4]) > 0) ? PDU_HEADER_LEN + FEC_HEADER_LEN + atoi(argv[4]) : MAX_PDU);
+	}
 
 	while (state != DONE) 
 	{
@@ -146,11 +376,11 @@ void processFile (char * argv[]) {
 
 			// START: establish connection with server and transmit filename, buffer size, and window size
 			case START_STATE: 
-				state = start_state(argv, server, &clientSeqNum, &data_packet_len);
+				state = start_state(argv, server, &clientSeqNum, &data_packet_len, &rxBatch, &init_time);
 				break;
 				
 			case FILENAME:
-				state = filename(argv[1], atoi(argv[4]), server);
+				state = filename(argv[1], atoi(argv[4]), server, init_time, &rtt, &data_packet_len);
 				break;
 		
 			case DONE:
@@ -158,19 +388,23 @@ void processFile (char * argv[]) {
 				break;
 			
 			case FILE_OK:
-				state = file_ok(&output_file_fd, argv[2], clientWindow, atoi(argv[3]));
+				state = file_ok(&output_file_fd, argv[2], clientWindow, agreedWindow, data_packet_len);
 				break;
 			
 			case RECV_DATA:
-				state = recv_data(output_file_fd, server, &clientSeqNum, clientWindow, &expected, &highest, &data_packet_len, &final_packet_len, &final_packet_seq, &eof_seq);
+				state = recv_data(output_file_fd, server, &clientSeqNum, clientWindow, &expected, &highest, &data_packet_len, &final_packet_len, &final_packet_seq, &eof_seq, &rxBatch, &rtt);
 				break;
 
 			case BUFFER:
-				state = buffer(output_file_fd, server, &clientSeqNum, clientWindow, &expected, &highest, &data_packet_len, &final_packet_len, &final_packet_seq, &eof_seq);
+				state = buffer(output_file_fd, server, &clientSeqNum, clientWindow, &expected, &highest, &data_packet_len, &final_packet_len, &final_packet_seq, &eof_seq, &rxBatch, &rtt);
 				break;
 
 			case FLUSH:
-				state = flush(output_file_fd, server,  &clientSeqNum, clientWindow, &expected, &highest, &data_packet_len, &final_packet_len, &final_packet_seq, &eof_seq);
+				state = flush(output_file_fd, server,  &clientSeqNum, clientWindow, &expected, &highest, &data_packet_len, &final_packet_len, &final_packet_seq, &eof_seq, &rtt);
+				break;
+
+			case DELTA_SIGS:
+				state = send_sigs(server, &clientSeqNum, &rtt);
 				break;
 
 			case WAIT_FILE_ACK:
@@ -178,27 +412,442 @@ void processFile (char * argv[]) {
 				
 		}	
 	}
+
+	// Gave up: whatever came in still goes to disk
+	disk_done();
 }
 
-STATE recv_data(int32_t output_file, struct Connection * server, uint32_t * clientSeqNum, struct window *clientWindow, uint32_t *expected, uint32_t *highest, uint32_t *data_packet_len, uint32_t *final_packet_len, uint32_t *final_packet_seq, uint32_t *eof_seq)
+// Hands out the next PDU, only touching the socket once the current batch is used up.
+// Waits one RTO, returns RECV_TIMEOUT so the caller can re-ack and RECV_GIVE_UP after MAX_RETRANS silent RTOs.
+// Parity PDUs are used up here: a DATA PDU they rebuild is handed out as if it had arrived
+int32_t recv_pdu(struct Connection * server, struct batch *rxBatch, uint8_t **pdu, uint8_t *flag, uint64_t *seq_num, struct rtt *rtt, struct window *clientWindow, uint64_t expected)
 {
-	
+	static uint8_t single[MAX_PDU];
+	static int timeouts = 0;
+	int32_t pdu_len = 0;
+	uint32_t wire = 0;
+
+	// A retransmission may have left a held parity group one PDU short
+	if (fecDec.enabled && ((pdu_len = fec_retry(&fecDec, clientWindow, expected)) > 0))
+	{
+		*pdu = fecDec.recovered;
+		getHeader(*pdu, flag, &wire);
+		*seq_num = seq_expand(wire, expected);
+		return pdu_len;
+	}
+
+	while (1)
+	{
+		if (options.batch)
+		{
+			// Refill with one recvmmsg() once every queued datagram has been handled
+			while ((*pdu = batch_next(rxBatch, &pdu_len)) == NULL)
+			{
+				int32_t waited = wait_pdu(rtt, &timeouts);
+				if (waited != 0) {
+					return waited;
+				}
+
+				recv_batch(rxBatch, server);
+			}
+
+			getHeader(*pdu, flag, &wire);
+			*seq_num = seq_expand(wire, expected);
+		}
+		else
+		{
+			int32_t waited = wait_pdu(rtt, &timeouts);
+			if (waited != 0) {
+				return waited;
+			}
+
+			pdu_len = recv_buf(single, MAX_PDU, server->sk_num, server, flag, &wire);
+			*seq_num = seq_expand(wire, expected);
+			*pdu = single;
+		}
+
+		// Server is alive again, stop backing off
+		if (timeouts != 0)
+		{
+			timeouts = 0;
+			rtt_restore(rtt);
+		}
+
+		if ((*flag != FEC_PARITY) || (pdu_len == CRC_ERROR))
+		{
+			return pdu_len;
+		}
+
+		// Parity: rebuild from it, or say the hole at expected needs a retransmission after all
+		if (fecDec.enabled && (in_cksum((unsigned short *)*pdu, pdu_len) == 0))
+		{
+			uint64_t start = 0;
+			uint32_t count = 0;
+			uint64_t parity_next = fecDec.parity_next;
+
+			fec_group(*pdu, expected, &start, &count);
+
+			if ((pdu_len = fec_receive(&fecDec, *pdu, pdu_len, clientWindow, expected)) > 0)
+			{
+				*pdu = fecDec.recovered;
+				getHeader(*pdu, flag, &wire);
+				*seq_num = seq_expand(wire, expected);
+				return pdu_len;
+			}
+
+			// Only the first parity past the hole reports it, the timeout covers it after that
+			if ((expected < start + count) && (expected >= parity_next))
+			{
+				fecDeadline = 0;
+				return RECV_FEC_MISS;
+			}
+		}
+	}
+}
+
+// Waits for the socket for one RTO, or only until a held-back RR comes due (RECV_ACK_DUE)
+// or a hole gave up on its parity (RECV_FEC_MISS)
+int32_t wait_pdu(struct rtt *rtt, int *timeouts)
+{
+	int64_t timeout = rtt_timeout(rtt);
+	int ack_due = 0;
+	int fec_due = 0;
+
+	if (ackState.unacked != 0)
+	{
+		int64_t until = ackState.deadline - rtt_now();
+		if (until < timeout)
+		{
+			timeout = (until > 0) ? until : 0;
+			ack_due = 1;
+		}
+	}
+
+	if (fecDeadline != 0)
+	{
+		int64_t until = fecDeadline - rtt_now();
+		if (until < timeout)
+		{
+			timeout = (until > 0) ? until : 0;
+			ack_due = 0;
+			fec_due = 1;
+		}
+	}
+
+	// Queued writes go to the kernel once the socket has nothing waiting, not one syscall per PDU
+	if ((ring.queued != 0) && (pollCallMicro(0) == -1)) {
+		disk_ring_submit(&ring);
+	}
+
+	if (pollCallMicro(timeout) != -1) {
+		return 0;
+	}
+
+	if (fec_due) {
+		fecDeadline = 0;
+		return RECV_FEC_MISS;
+	}
+
+	if (ack_due) {
+		return RECV_ACK_DUE;
+	}
+
+	rtt_backoff(rtt);
+	return (++(*timeouts) > MAX_RETRANS) ? RECV_GIVE_UP : RECV_TIMEOUT;
+}
+
+// Owes an RR for ack_seq, sent right away when now is set or ack_every PDUs are waiting on it
+void ack_queue(struct Connection * server, uint64_t * clientSeqNum, uint64_t ack_seq, int now)
+{
+	if (ackState.unacked == 0)
+	{
+		ackState.deadline = rtt_now() + options.ack_delay;
+	}
+
+	ackState.unacked++;
+	ackState.ack_seq = ack_seq;
+
+	if (now || (ackState.unacked >= options.ack_every))
+	{
+		ack_flush(server, clientSeqNum);
+	}
+}
+
+// Sends the RR owed for held-back PDUs, if any
+void ack_flush(struct Connection * server, uint64_t * clientSeqNum)
+{
+	uint8_t packet[MAXPDUBUF];
+	uint32_t net_ack = htonl(ackState.ack_seq);
+
+	if (ackState.unacked == 0)
+	{
+		return;
+	}
+
+	send_buf((uint8_t *)&net_ack, sizeof(net_ack), server, RR, clientSeqNum, packet);
+	(*clientSeqNum)++;
+	ackState.unacked = 0;
+}
+
+// Acks everything below expected and maps what is buffered past it, bit i is expected + 1 + i
+void send_sack(struct Connection * server, uint64_t * clientSeqNum, struct window *clientWindow, uint64_t expected)
+{
+	uint8_t payload[MAXBUF];
+	uint8_t packet[MAXPDUBUF];
+	uint32_t net_expected = htonl(expected);
+	int32_t bits = clientWindow->size - 1;
+	int32_t bytes = 0;
+
+	if (bits > (MAXBUF - 4) * 8)
+		bits = (MAXBUF - 4) * 8;
+
+	memcpy(payload, &net_expected, 4);
+	memset(payload + 4, 0, (bits + 7) / 8);
+
+	for (int32_t i = 0; i < bits; i++)
+	{
+		if (window_has(clientWindow, expected + 1 + i))
+		{
+			payload[4 + i / 8] |= 0x80 >> (i % 8);
+			bytes = i / 8 + 1; // Trailing empty bytes are left off
+		}
+	}
+
+	send_buf(payload, 4 + bytes, server, SACK, clientSeqNum, packet);
+	(*clientSeqNum)++;
+}
+
+// Gives the hole at expected srtt / FEC_WAIT_DIV to be rebuilt from its parity before it is reported
+void fec_hold(struct rtt *rtt)
+{
+	if (fecDeadline == 0)
+	{
+		fecDeadline = rtt_now() + ((rtt->srtt != 0) ? rtt->srtt : rtt_timeout(rtt)) / FEC_WAIT_DIV;
+	}
+}
+
+// Giving up with -c: PDUs buffered past the hole go to disk too, then the checkpoint records all of it
+void checkpoint(int32_t output_file, struct window *clientWindow, uint64_t expected, uint64_t highest)
+{
+	int32_t len = 0;
+	uint8_t *packet = NULL;
+
+	if (!options.resume)
+		return;
+
+	for (uint64_t seq = expected; seq <= highest; seq++)
+	{
+		if (window_isvalid(clientWindow, seq) && ((packet = window_find(clientWindow, seq, &len)) != NULL) && (packet[6] != END_OF_FILE))
+			writeDisk(output_file, len, packet, clientWindow, seq);
+	}
+
+	disk_done();
+	resume_save(&resume, clientWindow->slot_len - 7);
+}
+
+// A PDU past the hole: placed in the file right away, or held in the window until flush
+void hold(int32_t output_file, struct window *clientWindow, uint64_t seq_num, uint8_t flag, uint8_t *data_buf, int32_t data_len)
+{
+	if (placing && (flag != END_OF_FILE))
+		writeDisk(output_file, data_len, data_buf, clientWindow, seq_num);
+
+	window_add(clientWindow, seq_num, data_buf, data_len);
+}
+
+// The hole below seq_num is filled: a held PDU is written out now (a placed one already was)
+void release(int32_t output_file, struct window *clientWindow, uint64_t seq_num)
+{
+	int32_t packet_len = 0;
+	uint8_t *packet = window_find(clientWindow, seq_num, &packet_len);
+
+	if (packet != NULL)
+		writeDisk(output_file, packet_len, packet, clientWindow, seq_num);
+
+	window_remove(clientWindow, seq_num);
+}
+
+// The hole below seq_num is filled and the PDUs held up to last follow it: those back to back in the file
+// go out with one pwritev(), straight from their window slots. Returns how many, 0 leaves seq_num to release
+uint64_t release_run(int32_t output_file, struct window *clientWindow, uint64_t seq_num, uint64_t last)
+{
+	struct iovec iov[FLUSH_MAX_IOV];
+	struct iovec *next = iov;
+	int32_t packet_len = 0;
+	uint8_t *packet = NULL;
+	ssize_t written = 0;
+	off_t total = 0;
+	off_t done = 0;
+	int count = 0;
+	int left = 0;
+
+	// Only in-order appends line up: stripes and resumes jump around, placed PDUs are already out,
+	// a delta is decoded record by record and the ring takes its own copies
+	if (delta.active || options.resume || (options.stripes > 1) || placing || ring.active)
+		return 0;
+
+	while ((seq_num + count <= last) && (count < FLUSH_MAX_IOV) && window_isvalid(clientWindow, seq_num + count)
+		&& ((packet = window_find(clientWindow, seq_num + count, &packet_len)) != NULL)
+		&& (packet[6] != END_OF_FILE) && !(packet[6] & PDU_COMPRESSED))
+	{
+		iov[count].iov_base = packet + 7;
+		iov[count].iov_len = packet_len - 7;
+		total += packet_len - 7;
+		count++;
+	}
+
+	// A single PDU is no different from release
+	if (count < 2)
+		return 0;
+
+	// A short write carries on where it stopped, every later chunk lines up behind this run
+	for (left = count; left > 0; done += written)
+	{
+		if ((written = pwritev(output_file, next, left, appended + done)) < 0)
+		{
+			perror("Error writing output file");
+			exit(1);
+		}
+
+		// Skip the payloads it finished, the rest of the one it stopped in goes next
+		ssize_t n = written;
+		while ((left > 0) && (n >= (ssize_t)next->iov_len))
+		{
+			n -= next->iov_len;
+			next++;
+			left--;
+		}
+		if (left > 0)
+		{
+			next->iov_base = (uint8_t *)next->iov_base + n;
+			next->iov_len -= n;
+		}
+	}
+	appended += total;
+
+	for (int i = 0; i < count; i++)
+		window_remove(clientWindow, seq_num + i);
+
+	return count;
+}
+
+// Last PDU is in: the checkpoint goes away, a resumed file is cut to its length, a delta's new file replaces the old one
+void transfer_done(int32_t output_file, struct window *clientWindow, uint64_t eof_seq)
+{
+	struct stat st;
+
+	disk_done();
+	resume_finish(&resume);
+
+	// Whatever a longer file left past the end isn't part of this one
+	if (options.resume && (fstat(output_file, &st) == 0)
+		&& (ftruncate(output_file, resume_length(&resume, eof_seq, clientWindow->slot_len - 7, st.st_size)) < 0))
+	{
+		perror("Error truncating output file");
+		exit(1);
+	}
+
+	if (delta.active)
+	{
+		if (delta_finish(&delta) < 0)
+		{
+			perror("Error replacing output file");
+			exit(1);
+		}
+		printf("Delta: %llu bytes from the old file, %llu sent\n", (unsigned long long)delta.copied, (unsigned long long)delta.literal_bytes);
+	}
+
+	if (zip.chunk_bytes != 0)
+	{
+		printf("Compressed: %llu bytes came in as %llu\n", (unsigned long long)zip.chunk_bytes, (unsigned long long)zip.wire_bytes);
+	}
+}
+
+// Uploads the old file's signatures with -D, a burst at a time. The server RRs the next one it wants,
+// a burst goes again from there when its RR doesn't come
+STATE send_sigs(struct Connection * server, uint64_t * clientSeqNum, struct rtt *rtt)
+{
+	static uint32_t acked = 0;
+	static int retryCount = 0;
+	uint8_t payload[MAXBUF];
+	uint8_t packet[MAX_PDU];
+	uint32_t next = acked;
+	uint32_t count = 0;
 	uint32_t seq_num = 0;
+	uint8_t flag = 0;
+	int32_t len = 0;
+	STATE state = DELTA_SIGS;
+
+	for (int i = 0; (i < DELTA_SIG_BURST) && (next < delta.block_count); i++)
+	{
+		len = delta_sig_payload(&delta, next, payload, &count);
+		send_buf(payload, len, server, DELTA_SIG, clientSeqNum, packet);
+		(*clientSeqNum)++;
+		next += count;
+	}
+
+	while (acked < next)
+	{
+		if ((state = processSelect(server, &retryCount, DELTA_SIGS, RECV_DATA, DONE, rtt)) != RECV_DATA)
+			return state;
+
+		len = recv_buf(packet, MAX_PDU, server->sk_num, server, &flag, &seq_num);
+		if ((len == CRC_ERROR) || (in_cksum((unsigned short *)packet, len) != 0))
+			continue;
+
+		if ((flag == RR) && (len >= 11))
+		{
+			uint32_t net_next = 0;
+			memcpy(&net_next, packet + 7, 4);
+			if (ntohl(net_next) > acked)
+				acked = ntohl(net_next);
+		}
+
+		// The server only sends data once it has everything, this PDU comes again when its hole is reported
+		else if ((flag == DATA) || (flag == FEC_PARITY) || (flag == END_OF_FILE))
+			return RECV_DATA;
+	}
+
+	return (acked >= delta.block_count) ? RECV_DATA : DELTA_SIGS;
+}
+
+STATE recv_data(int32_t output_file, struct Connection * server, uint64_t * clientSeqNum, struct window *clientWindow, uint64_t *expected, uint64_t *highest, uint32_t *data_packet_len, uint32_t *final_packet_len, uint64_t *final_packet_seq, uint64_t *eof_seq, struct batch *rxBatch, struct rtt *rtt)
+{
+	
+	uint64_t seq_num = 0;
 	uint32_t ackSeqNum = 0;
 	uint8_t flag = 0 ;
 	int32_t data_len = 0;
-	uint8_t data_buf[MAXPDUBUF];
+	uint8_t *data_buf = NULL;
 	uint8_t packet[MAXPDUBUF];
 
 
-	// Poll for 10 seconds
-	if (pollCall(10000) == -1) {
+	// Receive Data Packet from Server (wait one RTO)
+	if ((data_len = recv_pdu(server, rxBatch, &data_buf, &flag, &seq_num, rtt, clientWindow, *expected)) == RECV_GIVE_UP) {
 		printf("Timed out waiting for data\n");
+		checkpoint(output_file, clientWindow, *expected, *highest);
 		return DONE;
 	}
-
-	// Receive Data Packet from Server
-	data_len = recv_buf(data_buf, MAXPDUBUF, server->sk_num, server, &flag, &seq_num);
+	else if (data_len == RECV_ACK_DUE) {
+		// Held-back RR ran out of time
+		ack_flush(server, clientSeqNum);
+		return RECV_DATA;
+	}
+	else if (data_len == RECV_FEC_MISS) {
+		// Tail of a parity group lost with nothing after it yet, ask for expected
+		ack_flush(server, clientSeqNum);
+		ackSeqNum = htonl(*expected);
+		send_buf((uint8_t *)&ackSeqNum, sizeof(ackSeqNum), server, SREJ, clientSeqNum, packet);
+		(*clientSeqNum)++;
+		return RECV_DATA;
+	}
+	else if (data_len == RECV_TIMEOUT) {
+		// Repeat the RR in case it was the one lost (it covers anything held back too)
+		ackState.unacked = 0;
+		ackSeqNum = htonl(*expected);
+		send_buf((uint8_t *)&ackSeqNum, sizeof(ackSeqNum), server, RR, clientSeqNum, packet);
+		(*clientSeqNum)++;
+		return RECV_DATA;
+	}
 	
 	// Check for Flipped bits
 	if ((in_cksum((unsigned short *)data_buf, data_len) != 0) || (data_len == CRC_ERROR)) 
@@ -238,30 +887,32 @@ STATE recv_data(int32_t output_file, struct Connection * server, uint32_t * clie
 		{
 			send_buf((uint8_t *)&ackSeqNum, sizeof(ackSeqNum), server, EOF_ACK, clientSeqNum, packet);
 			printf("Finished Tranmission\n");
+			transfer_done(output_file, clientWindow, seq_num);
 			exit(0);
 		}
 		
 		// Received Data in order
 		else
 		{
-			// Send RR for Data
-			send_buf((uint8_t *)&ackSeqNum, sizeof(ackSeqNum), server, RR, clientSeqNum, packet);
+			// Send RR for Data, held back with -a unless this was a retransmission (server is recovering)
+			ack_queue(server, clientSeqNum, seq_num + 1, flag != DATA);
 		}
 
 
 		//  Write in-order data to disk
-		int actual_data_len = data_len - 7;
-		uint8_t data[actual_data_len]; 
-		memcpy(data, data_buf + 7, actual_data_len);
-		write(output_file, &data, actual_data_len); // Write to disk
+		writeDisk(output_file, data_len, data_buf, clientWindow, seq_num);
+
+		// Parity groups still XOR against it, the slot keeps it until seq + window size shows up
+		if (fecDec.enabled)
+		{
+			window_add(clientWindow, seq_num, data_buf, data_len);
+			window_remove(clientWindow, seq_num);
+		}
 
 		// Update buffer related variables
 		*highest = *expected;
 		(*expected)++;
 
-		// Increment sequence number
-		(*clientSeqNum)++;
-
 	}
 
 	// Out of Order Data
@@ -271,13 +922,29 @@ STATE recv_data(int32_t output_file, struct Connection * server, uint32_t * clie
 		// printf("     Received: %d\n", seq_num);
 		// printf("     Highest: %d\n\n", *highest);
 
+		// Holes are reported right away, anything held back goes out first
+		ack_flush(server, clientSeqNum);
+
+		// With parity on its way the hole may never need a retransmission, report it once the parity failed
+		// (or didn't show up in time)
+		int fec_wait = fecDec.enabled && (*expected >= fecDec.parity_next);
+		if (fec_wait)
+			fec_hold(rtt);
+
 		// SREJ expected sequence number #
-		uint8_t srej_packet[MAXPDUBUF];
-		uint32_t net_expected = htonl(*expected);
-		send_buf((uint8_t*)&net_expected, sizeof(net_expected), server, SREJ, clientSeqNum, srej_packet);
+		if (!options.sack && !fec_wait)
+		{
+			uint8_t srej_packet[MAXPDUBUF];
+			uint32_t net_expected = htonl(*expected);
+			send_buf((uint8_t*)&net_expected, sizeof(net_expected), server, SREJ, clientSeqNum, srej_packet);
+		}
 		
 		// Store into buffer
-		window_add(clientWindow, seq_num, data_buf, data_len);
+		hold(output_file, clientWindow, seq_num, flag, data_buf, data_len);
+
+		// SACK goes out after buffering so the bitmap already has this PDU
+		if (options.sack && !fec_wait)
+			send_sack(server, clientSeqNum, clientWindow, *expected);
 
 		// printf("Buffered Seq #%d\n", seq_num);
 
@@ -289,6 +956,7 @@ STATE recv_data(int32_t output_file, struct Connection * server, uint32_t * clie
 	}
 
 	else {
+		ack_flush(server, clientSeqNum);
 		ackSeqNum = htonl(seq_num + 1); // RR value will be +1 the sequence number
 		send_buf((uint8_t *)&ackSeqNum, sizeof(ackSeqNum), server, RR, clientSeqNum, packet);
 		(*clientSeqNum)++;
@@ -298,27 +966,39 @@ STATE recv_data(int32_t output_file, struct Connection * server, uint32_t * clie
 
 }
 
-STATE buffer(int32_t output_file, struct Connection * server, uint32_t * clientSeqNum, struct window *clientWindow, uint32_t *expected, uint32_t *highest, uint32_t *data_packet_len, uint32_t *final_packet_len, uint32_t *final_packet_seq, uint32_t *eof_seq)
+STATE buffer(int32_t output_file, struct Connection * server, uint64_t * clientSeqNum, struct window *clientWindow, uint64_t *expected, uint64_t *highest, uint32_t *data_packet_len, uint32_t *final_packet_len, uint64_t *final_packet_seq, uint64_t *eof_seq, struct batch *rxBatch, struct rtt *rtt)
 {
 	// printf("\nIn Buffering State\n\n");
 
 	// printf("\nOUT OF ORDER DATA\n");
 	// printf("     Expected: %d\n", *expected);
 	// printf("     Highest: %d\n\n", *highest);
-	uint32_t seq_num = 0;
+	uint64_t seq_num = 0;
 	uint8_t flag = 0 ;
 	int32_t data_len = 0;
-	uint8_t data_buf[MAXPDUBUF];
+	uint8_t *data_buf = NULL;
 
 
-	// Poll for 10 seconds
-	if (pollCall(10000) == -1) {
+	// Receive data from server (wait one RTO)
+	if ((data_len = recv_pdu(server, rxBatch, &data_buf, &flag, &seq_num, rtt, clientWindow, *expected)) == RECV_GIVE_UP) {
 		printf("Timed out waiting for data\n");
+		checkpoint(output_file, clientWindow, *expected, *highest);
 		return DONE;
 	}
+	else if ((data_len == RECV_TIMEOUT) || (data_len == RECV_FEC_MISS)) {
+		// Repeat the SREJ for the hole in case it or its retransmission was lost (or parity couldn't fill it)
+		if (options.sack)
+		{
+			send_sack(server, clientSeqNum, clientWindow, *expected);
+			return BUFFER;
+		}
 
-	// Receive data from server
-	data_len = recv_buf(data_buf, MAXPDUBUF, server->sk_num, server, &flag, &seq_num);
+		uint8_t packet[MAXPDUBUF];
+		uint32_t net_expected = htonl(*expected);
+		send_buf((uint8_t*)&net_expected, sizeof(net_expected), server, SREJ, clientSeqNum, packet);
+		(*clientSeqNum)++;
+		return BUFFER;
+	}
 	// printf("\n\nRecived : %d\n", data_len);
 	// printf("Seq: %d\n", seq_num);
 	// Check for Flipped bits
@@ -332,6 +1012,17 @@ STATE buffer(int32_t output_file, struct Connection * server, uint32_t * clientS
 		uint8_t packet[MAXPDUBUF];
 		uint32_t net_expected = htonl(*expected);
 		uint32_t net_seq = htonl(seq_num+1);
+
+		// Late copy of a PDU parity already rebuilt, the hole at expected is reported on its own
+		if (fecDec.enabled)
+			return BUFFER;
+
+		// One SACK carries both the hole and the cumulative ack
+		if (options.sack)
+		{
+			send_sack(server, clientSeqNum, clientWindow, *expected);
+			return BUFFER;
+		}
 		
 		// Send SREJ
 		send_buf((uint8_t*)&net_expected, sizeof(net_expected), server, SREJ, clientSeqNum, packet);
@@ -339,7 +1030,8 @@ STATE buffer(int32_t output_file, struct Connection * server, uint32_t * clientS
 		// Send RR
 		send_buf((uint8_t*)&net_seq, sizeof(net_seq), server, RR, clientSeqNum, packet);
 
-		return RECV_DATA;
+		// Whatever is buffered past the hole is still there
+		return BUFFER;
 
 	}
 
@@ -368,23 +1060,18 @@ STATE buffer(int32_t output_file, struct Connection * server, uint32_t * clientS
 
 
 		// Write to Disk
-		int actual_data_len = data_len - 7;
-		uint8_t data[actual_data_len]; 
-		memcpy(data, data_buf + 7, actual_data_len);
-		// printf("Printing: %s\n", data);
 		// printPDU(data_buf, data_len);
-
-		// printf("ACtual: %d\n", actual_data_len);
-		write(output_file, &data, actual_data_len);
+		writeDisk(output_file, data_len, data_buf, clientWindow, seq_num);
 
 		// printf("Writing this much %d\n", actual_data_len);
 
+		// Kept for parity groups still XORing against it
+		if (fecDec.enabled)
+			window_add(clientWindow, seq_num, data_buf, data_len);
 		window_remove(clientWindow, seq_num); // Invalidate packet in window
 		
 		// Increment expected
 		(*expected)++;
-
-		data[actual_data_len] = '\0';
 		
 
 		return FLUSH;
@@ -392,13 +1079,23 @@ STATE buffer(int32_t output_file, struct Connection * server, uint32_t * clientS
 
 	// Out of Order Data
 	else {
-		
+		int new_hole = (seq_num > *highest + 1);
+
 		// Store into buffer
-		window_add(clientWindow, seq_num, data_buf, data_len);
+		hold(output_file, clientWindow, seq_num, flag, data_buf, data_len);
+
+		// Only a gap the server hasn't been told about yet is worth a SACK, and not while its parity is still coming
+		if (fecDec.enabled && (*highest + 1 >= fecDec.parity_next))
+			new_hole = 0;
+
+		if (options.sack && new_hole)
+			send_sack(server, clientSeqNum, clientWindow, *expected);
 		
 		// printf("Buffered Seq #%d\n", seq_num);
 
-		*highest = seq_num;
+		// A retransmission or rebuilt PDU can land below the highest one buffered
+		if (seq_num > *highest)
+			*highest = seq_num;
 
 		// printf("\nOUT OF ORDER DATA\n");
 		// printf("     Expected: %d\n", *expected);
@@ -412,16 +1109,16 @@ STATE buffer(int32_t output_file, struct Connection * server, uint32_t * clientS
 	return BUFFER;
 }
 
-STATE flush(int32_t output_file, struct Connection * server, uint32_t * clientSeqNum, struct window *clientWindow, uint32_t *expected, uint32_t *highest, uint32_t *data_packet_len, uint32_t *final_packet_len, uint32_t *final_packet_seq, uint32_t *eof_seq)
+STATE flush(int32_t output_file, struct Connection * server, uint64_t * clientSeqNum, struct window *clientWindow, uint64_t *expected, uint64_t *highest, uint32_t *data_packet_len, uint32_t *final_packet_len, uint64_t *final_packet_seq, uint64_t *eof_seq, struct rtt *rtt)
 {
 	// printf("Flushing\n");
 
 	// Initiate current sequence pointer within buffer
-	uint32_t cur_seq = *expected;
+	uint64_t cur_seq = *expected;
 	
 	printf("\nOUT OF ORDER DATA\n");
-	printf("     Expected: %d\n", *expected);
-	printf("     Highest: %d\n\n", *highest);
+	printf("     Expected: %llu\n", (unsigned long long)*expected);
+	printf("     Highest: %llu\n\n", (unsigned long long)*highest);
 
 	// Flush data out of buffer (checks for holes in buffer)
 	while ((cur_seq == *expected) && (window_isvalid(clientWindow, cur_seq) == 1))
@@ -435,11 +1132,6 @@ STATE flush(int32_t output_file, struct Connection * server, uint32_t * clientSe
 		// printf("     Highest: %d\n\n", *highest);
 		// printf("     Current Seq: %d\n", cur_seq);
 
-		// Retrieve flushed packet from buffer
-		uint8_t *packet = window_get_packet(clientWindow, cur_seq);
-		// Write to disk
-		uint32_t packet_len = 0;
-
 		if (cur_seq == *eof_seq)
 		{
 			printf("\nFinished Transmission\n");
@@ -448,30 +1140,26 @@ STATE flush(int32_t output_file, struct Connection * server, uint32_t * clientSe
 			uint32_t net_expected = htonl(*expected);
 			send_buf((uint8_t*)&net_expected, sizeof(net_expected), server, EOF_ACK, clientSeqNum, rr_packet);
 			
+			transfer_done(output_file, clientWindow, *eof_seq);
 			exit(0);
 		}
-		else if (cur_seq == *final_packet_seq)
+
+		// Write to disk and invalidate packet in window, the run below highest at once when it can
+		uint64_t run = release_run(output_file, clientWindow, cur_seq, *highest - 1);
+		if (run != 0)
 		{
-			packet_len = *final_packet_len;
+			*expected += run;
+			cur_seq += run;
+			continue;
 		}
-		else
-			packet_len = *data_packet_len;
-
-		int actual_data_len = packet_len - 7;//
-		uint8_t data[actual_data_len];
-		memcpy(data, packet + 7, actual_data_len);
-		write(output_file, &data, actual_data_len);
-	
 
-		// Invalidate packet in window
-		window_remove(clientWindow, cur_seq); 
+		release(output_file, clientWindow, cur_seq);
 
 		// printf("5\n");
 
 
 		// Increment expected and current sequence in buffer
-		data[actual_data_len] = '\0';
-		// printf("Writing Seq #%d: %s\n", cur_seq, data);
+		// printf("Writing Seq #%d\n", cur_seq);
 		// printf("EOF LEN: %d\n", final_packet_len);
 		// printf("EOF SEQ: %d\n", eof_seq);
 
@@ -504,42 +1192,27 @@ STATE flush(int32_t output_file, struct Connection * server, uint32_t * clientSe
 			send_buf((uint8_t*)&net_expected, sizeof(net_expected), server, RR, clientSeqNum, rr_packet);
 			send_buf((uint8_t*)&net_expected, sizeof(net_expected), server, EOF_ACK, clientSeqNum, rr_packet);
 			printf("\nFinished Transmission\n");
+			transfer_done(output_file, clientWindow, *eof_seq);
 			exit(0);
 		}
 		else
 			send_buf((uint8_t*)&net_expected, sizeof(net_expected), server, RR, clientSeqNum, rr_packet);
 
 
-		uint32_t packet_len = 0;
-		if (*expected == *final_packet_seq)
-		{
-			// printf("ASdnsdgbsdiug");
-			packet_len = *final_packet_len;
-		}
-		else
-			packet_len = *data_packet_len;
-
 		// printf("PENIS\n");
 		// printf("Expected: %d\nCurrent Seq: %d\n", *expected, cur_seq);
 		// printf("Final Packet Len:  %d\n", final_packet_len);
 		// printf("Final Packet Seq: %d\n", final_packet_seq);
 
-		// Write to Disk
-		uint8_t *packet = window_get_packet(clientWindow, *expected);
-		int actual_data_len = packet_len - 7;
-		uint8_t data[actual_data_len]; 
-		memcpy(data, packet + 7, actual_data_len);
-
-		// if ((*expected - 1) != eof_seq) 
-		write(output_file, &data, actual_data_len);
-
-		window_remove(clientWindow, *expected); // Invalidate packet in window
+		// Write to Disk and invalidate packet in window
+		release(output_file, clientWindow, *expected);
 		
 
 		// printf("Writing Seq #%d: %s (%d)\n", *expected, data, actual_data_len);
 
 	
 		(*expected)++;
+		fecDeadline = 0; // No hole left to wait on
 
 		return RECV_DATA;
 		
@@ -555,6 +1228,22 @@ STATE flush(int32_t output_file, struct Connection * server, uint32_t * clientSe
 		// printf("This Conditions\n");
 		uint8_t packet[MAXPDUBUF];
 		uint32_t net_expected = htonl(*expected);
+
+		// Parity still coming, or one held back can rebuild it on the next receive
+		if (fecDec.enabled && fec_repairable(&fecDec, clientWindow, *expected, *expected))
+			return BUFFER;
+
+		if (fecDec.enabled && (*expected >= fecDec.parity_next))
+		{
+			fec_hold(rtt);
+			return BUFFER;
+		}
+
+		if (options.sack)
+		{
+			send_sack(server, clientSeqNum, clientWindow, *expected);
+			return BUFFER;
+		}
 		
 		// Send SREJ
 		send_buf((uint8_t*)&net_expected, sizeof(net_expected), server, SREJ, clientSeqNum, packet);
@@ -569,65 +1258,152 @@ STATE flush(int32_t output_file, struct Connection * server, uint32_t * clientSe
 }
 
 
-STATE file_ok(int * outputFileFd, char *outputFileName, struct window *clientWindow, int32_t window_size) 
+STATE file_ok(int * outputFileFd, char *outputFileName, struct window *clientWindow, int32_t window_size, uint32_t slot_len) 
 {
 	STATE returnValue = DONE;
 
-	if ((*outputFileFd = open(outputFileName, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0)
+	// Stripes share a file the parent already truncated, a resume keeps what its checkpoint says is there
+	int truncate = ((options.stripes > 1) || (options.resume && resume.loaded)) ? 0 : O_TRUNC;
+
+	// A delta builds the new file aside, the old one is read for the copies until it is replaced
+	if (delta.active)
+		outputFileName = delta.tmp;
+
+	if ((*outputFileFd = open(outputFileName, O_CREAT | truncate | O_WRONLY, 0600)) < 0)
 	{
 		perror("Error on open of output file: ");
 		returnValue = DONE;
 	}
 	else
 	{
-		// File Exists
-		window_create(clientWindow, window_size); // Initialize window
-		returnValue = RECV_DATA;
+		// File Exists. Placed PDUs need nothing but their bit
+		if ((placing ? window_create_bits(clientWindow, window_size, slot_len) : window_create(clientWindow, window_size, slot_len)) < 0)
+		{
+			printf("Error: Unable to allocate space for buffer.\n");
+			exit(1);
+		}
+
+		if (options.fec)
+		{
+			fec_decoder_init(&fecDec, slot_len);
+			fecDec.enabled = 1;
+		}
+
+		// A delta writes its records itself, in order
+		if (options.uring && !delta.active && (disk_ring_init(&ring, *outputFileFd, window_size, slot_len - PDU_HEADER_LEN) < 0))
+			printf("io_uring unavailable, writing synchronously\n");
+
+		returnValue = delta.active ? DELTA_SIGS : RECV_DATA;
 	}
 	return returnValue;
 }
 
 
 
-STATE filename (char * fname, int32_t buf_size, struct Connection * server) {
+STATE filename (char * fname, int32_t buf_size, struct Connection * server, int64_t init_time, struct rtt *rtt, uint32_t *data_packet_len) {
 	int returnValue = START_STATE;
-	uint8_t packet[MAXPDUBUF];
+	uint8_t packet[MAX_PDU];
 	uint8_t flag = 0;
 	uint32_t seq_num = 0;
 	int32_t recv_check = 0;
 	static int retryCount = 0;
 	// printf("\nRetry Count: %d\n", retryCount);
 	
-	if ((returnValue = processSelect(server, &retryCount, START_STATE, FILE_OK, DONE)) == FILE_OK)
+	if ((returnValue = processSelect(server, &retryCount, START_STATE, FILE_OK, DONE, rtt)) == FILE_OK)
 	{
-
-		if (pollCall(10000) == -1) {
-			printf("Timed out waiting for data\n");
-			return DONE;
+		// Seed the estimator with the handshake round trip
+		if (init_time != 0)
+		{
+			rtt_sample(rtt, rtt_now() - init_time);
 		}
 		
 		// Receive establishment Data Packet or Filename Establishment ACK
-		recv_check = recv_buf(packet, MAXPDUBUF, server->sk_num, server, &flag, &seq_num);
+		recv_check = recv_buf(packet, MAX_PDU, server->sk_num, server, &flag, &seq_num);
 
-		// Check for Flipped bits
-		if (in_cksum((unsigned short *)packet, recv_check) != 0) 
-		{
-			retryCount++;
-			returnValue = FILENAME; // Ignore incorrect packet and continue waiting for initial packet.
-		}
-		
 		if (recv_check == CRC_ERROR)
 		{
 			returnValue = START_STATE;
 		}
+
+		// Check for Flipped bits, nothing in a damaged response (buffer size, options) can be trusted
+		else if (in_cksum((unsigned short *)packet, recv_check) != 0) 
+		{
+			retryCount++;
+			returnValue = FILENAME; // Ignore incorrect packet and continue waiting for initial packet.
+		}
 		else if (flag == FNAME_BAD)
 		{
 			printf("File %s not found\nn", fname);
 			exit(1);
 		}
-		else if (flag == DATA)
+		else if ((flag == FNAME_OK) && (recv_check >= 11))
+		{
+			// Server echoes the buffer size it settled on (buf_size 0 = sized to the path MTU)
+			uint32_t net_buf_size = 0;
+			memcpy(&net_buf_size, packet + 7, 4);
+			*data_packet_len = 7 + ntohl(net_buf_size);
+
+			// The server may have cut the window down, the RRs held back still have to fit half of it
+			uint16_t optLen = 0;
+			uint8_t *opt = init_opt_find(packet + 11, recv_check - 11, INIT_OPT_WINDOW, &optLen);
+			if ((opt != NULL) && (optLen == 4))
+			{
+				uint32_t net_window = 0;
+				memcpy(&net_window, opt, 4);
+				if ((ntohl(net_window) > 0) && (ntohl(net_window) < (uint32_t)agreedWindow))
+					agreedWindow = ntohl(net_window);
+				if (options.ack_every > agreedWindow / 2)
+					options.ack_every = (agreedWindow / 2 > 0) ? agreedWindow / 2 : 1;
+			}
+
+			// Parity only comes if the server echoed a group size back
+			opt = init_opt_find(packet + 11, recv_check - 11, INIT_OPT_FEC, &optLen);
+			if ((opt == NULL) || (optLen != 2) || (opt[0] == 0 && opt[1] == 0))
+				options.fec = 0;
+
+			// A server that ignored the stripe would send every stripe the whole file
+			if ((options.stripes > 1) && (init_opt_find(packet + 11, recv_check - 11, INIT_OPT_STRIPE, &optLen) == NULL))
+			{
+				printf("Server does not support striped transfers\n");
+				exit(1);
+			}
+
+			// Without the echo the server sends the file itself
+			if (delta.active && (init_opt_find(packet + 11, recv_check - 11, INIT_OPT_DELTA, &optLen) == NULL))
+			{
+				printf("Server did not accept the delta, fetching the whole file\n");
+				close(delta.basis_fd);
+				delta.active = 0;
+			}
+
+			// Without the echo every payload comes raw
+			if (zip.active && (init_opt_find(packet + 11, recv_check - 11, INIT_OPT_COMPRESS, &optLen) == NULL))
+				zip.active = 0;
+
+			// Without the echo the server sends the whole file from the start
+			if (options.resume && (init_opt_find(packet + 11, recv_check - 11, INIT_OPT_RESUME, &optLen) == NULL))
+			{
+				printf("Server did not accept the resume, fetching the whole file\n");
+				resume_reset(&resume);
+				options.resume = 0;
+			}
+
+			placing = !delta.active && !options.fec;
+		}
+		else if ((buf_size == 0) && zip.active && ((flag == FEC_PARITY) || (packet[6] & PDU_COMPRESSED)))
+		{
+			// Only a raw DATA PDU gives the buffer size away, the server never compresses the first one
+			returnValue = FILENAME;
+		}
+		else if ((flag == DATA) || (flag == FEC_PARITY))
 		{
 			// file yes/no packet lost - instead its a data packet
+			// the first one is full size unless the file fits in one PDU
+			if (buf_size == 0)
+				*data_packet_len = (flag == DATA) ? recv_check : recv_check - FEC_HEADER_LEN;
+
+			// A guessed buffer size is only good for data written in order
+			placing = (buf_size > 0) && !delta.active && !options.fec;
 			returnValue = FILE_OK;
 		}
 
@@ -640,7 +1416,7 @@ STATE filename (char * fname, int32_t buf_size, struct Connection * server) {
 
 
 // Function handles timeouts and retransmissions
-STATE processSelect(struct Connection *connection, int *retryCount, STATE TimeoutState, STATE DataState, STATE DoneState) {
+STATE processSelect(struct Connection *connection, int *retryCount, STATE TimeoutState, STATE DataState, STATE DoneState, struct rtt *rtt) {
     int returnValue = DataState;
     (*retryCount)++;
 	
@@ -649,7 +1425,7 @@ STATE processSelect(struct Connection *connection, int *retryCount, STATE Timeou
         returnValue = DoneState;
     } 
 	else {
-		if (pollCall(1000) != -1) 
+		if (pollCallMicro(rtt_timeout(rtt)) != -1) 
 		{
             *retryCount = 0;
             returnValue = DataState;
@@ -657,6 +1433,7 @@ STATE processSelect(struct Connection *connection, int *retryCount, STATE Timeou
 		else
 		{
             printf("We timed out\n");
+            rtt_backoff(rtt);
             returnValue = TimeoutState;
         } 
     }
@@ -694,11 +1471,101 @@ void checkArgs(int argc, char * argv[])
 {
 
         /* check command line arguments  */
-	if (argc != 8)
+	if (argc < 8)
+	{
+		printUsage();
+		exit(1);
+	}
+
+	// Optional flags come after the positional arguments
+	int opt = 0;
+	options.rto_min = RTO_MIN_DEFAULT;
+	options.rto_max = RTO_MAX_DEFAULT;
+	options.ack_every = 1;
+	options.ack_delay = ACK_DELAY_DEFAULT * 1000;
+
+	opterr = 0;
+	while ((opt = getopt(argc - 7, argv + 7, "a:bcd:Df:gkn:r:R:uz")) != -1)
+	{
+		switch (opt)
+		{
+			case 'a':
+				options.ack_every = atoi(optarg);
+				break;
+
+			case 'b':
+				options.batch = 1;
+				break;
+
+			case 'c':
+				options.resume = 1;
+				break;
+
+			case 'D':
+				options.delta = 1;
+				break;
+
+			case 'd':
+				options.ack_delay = atof(optarg) * 1000;
+				break;
+
+			case 'f':
+				options.fec = (atoi(optarg) > 0) ? atoi(optarg) : FEC_ADAPTIVE;
+				break;
+
+			case 'g':
+				options.gro = 1;
+				options.batch = 1; // GRO buffers come in through the batch
+				break;
+
+			case 'k':
+				options.sack = 1;
+				break;
+
+			case 'n':
+				options.stripes = atoi(optarg);
+				if ((options.stripes < 1) || (options.stripes > MAX_STRIPES))
+				{
+					printUsage();
+					exit(1);
+				}
+				break;
+
+			case 'r':
+				options.rto_min = atof(optarg) * 1000;
+				break;
+
+			case 'R':
+				options.rto_max = atof(optarg) * 1000;
+				break;
+
+			case 'u':
+				options.uring = 1;
+				break;
+
+			case 'z':
+				options.compress = 1;
+				break;
+
+			default:
+				printUsage();
+				exit(1);
+		}
+	}
+
+	if (optind != argc - 7)
 	{
-		printf("usage: rcopy from-filename to-filename window-size buffer-size error-rate remote-machine remote-port\n");
+		printUsage();
 		exit(1);
 	}
+
+	// rtt_init takes the bounds as given, a zero or negative floor or one above the ceiling makes no timeout
+	if ((options.rto_min <= 0) || (options.rto_max < options.rto_min))
+	{
+		printUsage();
+		exit(1);
+	}
+
 	if (strlen(argv[1]) > MAXFILELEN)
 	{
 	    printf("From File length too large\n");
@@ -715,20 +1582,154 @@ void checkArgs(int argc, char * argv[])
 		printf("Window Size too large\n");
 		exit(1);
 	}
-	if (strlen(argv[4]) > 1400)
+	if (atoi(argv[4]) > MAX_PAYLOAD)
+	{
+		printf("Buffer Size too large (max %d)\n", MAX_PAYLOAD);
+		exit(1);
+	}
+
+	// Stripe offsets come from the buffer size, every stripe has to use the same one
+	if ((options.stripes > 1) && (atoi(argv[4]) <= 0))
+	{
+		printf("Striped transfers need an explicit buffer-size\n");
+		exit(1);
+	}
+
+	// Chunk offsets come from the buffer size, it has to match the one the checkpoint was cut at
+	if (options.resume && ((atoi(argv[4]) <= 0) || (options.stripes > 1)))
 	{
-		printf("Buffer Size too large\n");
+		printf("Resume needs an explicit buffer-size and no stripes\n");
 		exit(1);
 	}
+
+	// Copies refer to the old file as a whole, a stripe or a resume only ever has part of the new one
+	if (options.delta && (options.resume || (options.stripes > 1)))
+	{
+		printf("Delta can't be combined with -c or -n\n");
+		exit(1);
+	}
+
+	// Never hold back more than half a window, the server must not run into its window edge waiting on an RR
+	if (options.ack_every > atoi(argv[3]) / 2)
+		options.ack_every = atoi(argv[3]) / 2;
+	if (options.ack_every < 1)
+		options.ack_every = 1;
+
+	agreedWindow = atoi(argv[3]);
 	
 }
 
+void printUsage()
+{
+	printf("usage: rcopy from-filename to-filename window-size buffer-size error-rate remote-machine remote-port [options]\n");
+	printf("  buffer-size up to %d, 0 lets the server size PDUs to the path MTU\n", MAX_PAYLOAD);
+	printf("  -b  drain each wakeup with one recvmmsg()\n");
+	printf("  -c  resume: keep what an earlier attempt wrote (see to-filename%s) and only fetch the rest (needs a buffer-size)\n", RESUME_SUFFIX);
+	printf("  -g  UDP GRO: receive coalesced PDU runs and split them (implies -b)\n");
+	printf("  -a N  send an RR every N in-order PDUs instead of each one\n");
+	printf("  -d ms  longest an RR is held back with -a (default %d)\n", ACK_DELAY_DEFAULT);
+	printf("  -D  delta: send block signatures of the existing to-filename, only differing data comes back\n");
+	printf("  -f K  forward error correction: one XOR parity PDU per K data PDUs (0 adapts K to the loss rate)\n");
+	printf("  -n N  striped: N sessions in parallel, session i gets every N'th PDU starting at i (1 to %d, needs a buffer-size)\n", MAX_STRIPES);
+	printf("  -k  selective acks: one SACK bitmap per hole report instead of SREJ/RR pairs\n");
+	printf("  -r ms  retransmission timeout floor (default %d)\n", RTO_MIN_DEFAULT / 1000);
+	printf("  -R ms  retransmission timeout ceiling (default %d)\n", RTO_MAX_DEFAULT / 1000);
+	printf("  -u  io_uring: queue output file writes, the receive loop never waits on the disk\n");
+	printf("  -z  compression: the server deflates every chunk that shrinks\n");
+}
+
 
-void writeDisk(int outputFileFd, uint32_t packet_len, uint8_t *packet, struct window *clientWindow, uint32_t seq_num)
+// Writes a PDU's payload: appended in order, or with stripes, a resume or placing at its chunk's place in the file.
+// With a delta the payloads are records that build the file
+void writeDisk(int outputFileFd, uint32_t packet_len, uint8_t *packet, struct window *clientWindow, uint64_t seq_num)
 {
+	static uint8_t inflated[MAX_PAYLOAD];
+	uint8_t *data = packet + 7;
 	int actual_data_len = packet_len - 7;//
-	uint8_t data[actual_data_len];
-	memcpy(data, packet + 7, actual_data_len);
-	write(outputFileFd, &data, actual_data_len);
+
+	// Everything below works on the chunk the server read
+	if (packet[6] & PDU_COMPRESSED)
+	{
+		if ((actual_data_len = decompress_chunk(&zip, packet + 7, packet_len - 7, inflated, clientWindow->slot_len - 7)) < 0)
+		{
+			printf("Bad compressed PDU %llu\n", (unsigned long long)seq_num);
+			exit(1);
+		}
+		data = inflated;
+	}
+
+	if (delta.active)
+	{
+		if (delta_apply(&delta, outputFileFd, data, actual_data_len) < 0)
+		{
+			printf("Bad delta stream\n");
+			exit(1);
+		}
+		return;
+	}
+
+	if (options.resume)
+	{
+		uint64_t chunk = resume_chunk(&resume, seq_num);
+		write_at(outputFileFd, data, actual_data_len, (off_t)chunk * (clientWindow->slot_len - 7));
+
+		// The checkpoint this may save can only list chunks that really are on disk
+		if (ring.active && (resume.since_save + 1 >= RESUME_INTERVAL))
+			disk_done();
+		resume_mark(&resume, chunk, actual_data_len, clientWindow->slot_len - 7);
+		return;
+	}
+
+	if (options.stripes > 1)
+	{
+		off_t chunk = (off_t)(seq_num - START_SEQ_NUM) * options.stripes + options.stripe;
+		write_at(outputFileFd, data, actual_data_len, chunk * (clientWindow->slot_len - 7));
+		return;
+	}
+
+	// Placed PDUs come in any order, the sequence number says where they go
+	if (placing)
+	{
+		write_at(outputFileFd, data, actual_data_len, (off_t)(seq_num - START_SEQ_NUM) * (clientWindow->slot_len - 7));
+		return;
+	}
+
+	// In order: the ring keeps no file position, so the end of what is written is tracked here
+	write_at(outputFileFd, data, actual_data_len, appended);
+	appended += actual_data_len;
+}
+
+// Hands a payload to the disk at offset: queued on the ring with -u, written right here otherwise
+void write_at(int outputFileFd, uint8_t *data, int32_t len, off_t offset)
+{
+	if (ring.active)
+	{
+		if (disk_ring_write(&ring, data, len, offset) < 0)
+		{
+			perror("Error writing output file");
+			exit(1);
+		}
+		return;
+	}
+
+	// A short write carries on where it stopped, a failed one would leave a hole that looks like a finished file
+	for (ssize_t written = 0; len > 0; data += written, len -= written, offset += written)
+	{
+		if ((written = pwrite(outputFileFd, data, len, offset)) < 0)
+		{
+			perror("Error writing output file");
+			exit(1);
+		}
+	}
+}
+
+// Waits for the queued writes before anything relies on them being on disk
+void disk_done(void)
+{
+	if (ring.active && (disk_ring_drain(&ring) < 0))
+	{
+		perror("Error writing output file");
+		exit(1);
+	}
 }
 
@@ -0,0 +1,185 @@
+#define _GNU_SOURCE // readahead
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "readahead.h"
+
+static void *readahead_run(void *arg);
+
+// Starts the reader on fd from offset 0 in chunks of chunk_len, -1 if it can't
+int readahead_start(struct readahead *ra, int fd, int32_t chunk_len) {
+    memset(ra, 0, sizeof(struct readahead));
+
+    if (chunk_len <= 0) {
+        return -1;
+    }
+
+    ra->fd = fd;
+    ra->chunk_len = chunk_len;
+    ra->slots = READAHEAD_BYTES / chunk_len;
+    if (ra->slots < READAHEAD_MIN_SLOTS) {
+        ra->slots = READAHEAD_MIN_SLOTS;
+    }
+
+    ra->ring = (uint8_t *) malloc((size_t)ra->slots * chunk_len);
+    ra->lens = (int32_t *) calloc(ra->slots, sizeof(int32_t));
+    if ((ra->ring == NULL) || (ra->lens == NULL)) {
+        free(ra->ring);
+        free(ra->lens);
+        return -1;
+    }
+
+    // The page cache can go further ahead than the ring: tell it the file is read once, in order
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    readahead(fd, 0, READAHEAD_BYTES);
+
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->ready, NULL);
+    pthread_cond_init(&ra->room, NULL);
+
+    if (pthread_create(&ra->thread, NULL, readahead_run, ra) != 0) {
+        free(ra->ring);
+        free(ra->lens);
+        return -1;
+    }
+
+    ra->active = 1;
+    return 0;
+}
+
+// Next chunk (*len gets its length: 0 at the end of the file, -1 with errno set on a read error).
+// Valid until the next call, which gives its slot back. Only waits when the reader is behind
+uint8_t *readahead_next(struct readahead *ra, int32_t *len) {
+    uint32_t slot = 0;
+
+    pthread_mutex_lock(&ra->lock);
+
+    // The previous chunk is in a PDU by now
+    if (ra->released < ra->taken) {
+        ra->released = ra->taken;
+        pthread_cond_signal(&ra->room);
+    }
+
+    while ((ra->taken == ra->filled) && !ra->done) {
+        pthread_cond_wait(&ra->ready, &ra->lock);
+    }
+
+    if (ra->taken == ra->filled) {
+        *len = (ra->error != 0) ? -1 : 0;
+        errno = ra->error;
+        pthread_mutex_unlock(&ra->lock);
+        return ra->ring;
+    }
+
+    slot = ra->taken % ra->slots;
+    *len = ra->lens[slot];
+    ra->taken++;
+
+    pthread_mutex_unlock(&ra->lock);
+    return ra->ring + (size_t)slot * ra->chunk_len;
+}
+
+// Stops the reader and waits for it, then gives the ring back
+void readahead_stop(struct readahead *ra) {
+    if (!ra->active) {
+        return;
+    }
+
+    pthread_mutex_lock(&ra->lock);
+    ra->stop = 1;
+    pthread_cond_signal(&ra->room);
+    pthread_mutex_unlock(&ra->lock);
+
+    pthread_join(ra->thread, NULL);
+
+    pthread_mutex_destroy(&ra->lock);
+    pthread_cond_destroy(&ra->ready);
+    pthread_cond_destroy(&ra->room);
+    free(ra->ring);
+    free(ra->lens);
+    ra->ring = NULL;
+    ra->lens = NULL;
+    ra->active = 0;
+}
+
+// Reader thread: fills every free slot it can reach without wrapping with one large read, then cuts it up
+static void *readahead_run(void *arg) {
+    struct readahead *ra = (struct readahead *)arg;
+    uint32_t per_read = READAHEAD_READ / ra->chunk_len;
+
+    if (per_read == 0) {
+        per_read = 1;
+    }
+
+    pthread_mutex_lock(&ra->lock);
+
+    while (!ra->done && !ra->stop) {
+        while ((ra->filled - ra->released == ra->slots) && !ra->stop) {
+            pthread_cond_wait(&ra->room, &ra->lock);
+        }
+        if (ra->stop) {
+            break;
+        }
+
+        uint32_t first = ra->filled % ra->slots;
+        uint32_t count = ra->slots - (uint32_t)(ra->filled - ra->released);
+        if (count > ra->slots - first) {
+            count = ra->slots - first;
+        }
+        if (count > per_read) {
+            count = per_read;
+        }
+
+        // The sender only touches slots below filled, these are the reader's until it moves filled on
+        pthread_mutex_unlock(&ra->lock);
+
+        uint8_t *dest = ra->ring + (size_t)first * ra->chunk_len;
+        size_t want = (size_t)count * ra->chunk_len;
+        size_t got = 0;
+        int error = 0;
+
+        while (got < want) {
+            ssize_t n = pread(ra->fd, dest + got, want - got, ra->offset + got);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                error = errno;
+                break;
+            }
+            if (n == 0) {
+                break;
+            }
+            got += n;
+        }
+
+        pthread_mutex_lock(&ra->lock);
+
+        uint32_t chunks = got / ra->chunk_len;
+        for (uint32_t i = 0; i < chunks; i++) {
+            ra->lens[first + i] = ra->chunk_len;
+        }
+        if (got % ra->chunk_len != 0) {
+            ra->lens[first + chunks] = got % ra->chunk_len;
+            chunks++;
+        }
+
+        ra->offset += got;
+        ra->filled += chunks;
+        if (got < want) {
+            ra->done = 1;
+            ra->error = error;
+        }
+
+        pthread_cond_signal(&ra->ready);
+    }
+
+    pthread_mutex_unlock(&ra->lock);
+    return NULL;
+}
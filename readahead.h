@@ -0,0 +1,44 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define READAHEAD_BYTES (4 << 20) // Ring the reader keeps filled ahead of the sender
+#define READAHEAD_READ (1 << 20) // Largest single read, cut into chunks once it is in
+#define READAHEAD_MIN_SLOTS 4
+
+// Server side: a thread reads the file front to back into a ring of chunks, so a slow disk only shows
+// when the sender has caught up with it. The sender is handed chunks in place, no copy
+struct readahead {
+    int active; // Reader running, chunks come from readahead_next
+    int fd;
+    int32_t chunk_len; // Buffer size, every chunk but the last is this long
+    uint32_t slots; // Chunks the ring holds
+    uint8_t *ring; // slots * chunk_len
+    int32_t *lens; // Length of the chunk in each slot
+    off_t offset; // Where the reader's next read starts
+    uint64_t filled; // Chunks read so far, the next goes in slot filled % slots
+    uint64_t taken; // Chunks handed to the sender
+    uint64_t released; // Chunks the sender is done with, their slots can be read into again
+    int done; // Reader reached the end of the file, filled won't move again
+    int error; // errno of a failed read, 0 if none
+    int stop; // Sender is done with the file, the reader quits where it is
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready; // Reader put chunks in
+    pthread_cond_t room; // Sender gave slots back
+};
+
+// Starts the reader on fd from offset 0 in chunks of chunk_len, -1 if it can't
+int readahead_start(struct readahead *ra, int fd, int32_t chunk_len);
+
+// Next chunk (*len gets its length: 0 at the end of the file, -1 with errno set on a read error).
+// Valid until the next call, which gives its slot back. Only waits when the reader is behind
+uint8_t *readahead_next(struct readahead *ra, int32_t *len);
+
+// Stops the reader and waits for it, then gives the ring back
+void readahead_stop(struct readahead *ra);
+
+#endif // READAHEAD_H
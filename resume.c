@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#include "pdu.h"
+#include "resume.h"
+
+#define RESUME_MAGIC "RCRS" // Checkpoint file: magic (4), buffer size (4), then an INIT_OPT_RESUME value
+
+static int resume_bit(struct resume *r, uint64_t chunk);
+static void resume_advance(struct resume *r);
+
+// Server side: takes rcopy's INIT_OPT_RESUME value, -1 if it doesn't fit buf_size
+int resume_decode(struct resume *r, uint8_t *value, uint16_t len, int32_t buf_size) {
+    uint32_t net_offset[2];
+    uint64_t offset = 0;
+    uint32_t bitmap_len = len - RESUME_HEADER_LEN;
+
+    memset(r, 0, sizeof(struct resume));
+
+    if ((len < RESUME_HEADER_LEN) || (bitmap_len > RESUME_MAX_BITS / 8) || (buf_size <= 0)) {
+        return -1;
+    }
+
+    memcpy(net_offset, value, RESUME_HEADER_LEN);
+    offset = ((uint64_t)ntohl(net_offset[0]) << 32) | ntohl(net_offset[1]);
+
+    // Chunk boundaries only line up when both ends cut the file the same way
+    if ((offset % buf_size) != 0) {
+        return -1;
+    }
+
+    r->start = offset / buf_size;
+    r->base = r->start;
+    r->span = bitmap_len * 8;
+    r->missing = (uint32_t *) malloc(r->span * sizeof(uint32_t) + 1);
+
+    for (uint32_t i = 0; i < r->span; i++) {
+        if (value[RESUME_HEADER_LEN + i / 8] & (1 << (i % 8))) {
+            r->bits[((r->start + i) % RESUME_MAX_BITS) / 8] |= 1 << ((r->start + i) % 8);
+        }
+        else {
+            r->missing[r->missing_count++] = i;
+        }
+    }
+
+    resume_advance(r);
+    r->active = 1;
+
+    return 0;
+}
+
+// Builds the INIT_OPT_RESUME value from what is on disk now, returns its length
+int resume_encode(struct resume *r, int32_t buf_size, uint8_t *value) {
+    uint64_t offset = r->base * buf_size;
+    uint32_t net_offset[2] = {htonl(offset >> 32), htonl(offset & 0xFFFFFFFF)};
+    int bitmap_len = 0;
+
+    memcpy(value, net_offset, RESUME_HEADER_LEN);
+
+    // Bitmap stops at the last chunk written past base
+    for (uint32_t i = 1; i < RESUME_MAX_BITS; i++) {
+        if (resume_bit(r, r->base + i)) {
+            bitmap_len = i / 8 + 1;
+        }
+    }
+
+    memset(value + RESUME_HEADER_LEN, 0, bitmap_len);
+    for (int i = 1; i < bitmap_len * 8; i++) {
+        if (resume_bit(r, r->base + i)) {
+            value[RESUME_HEADER_LEN + i / 8] |= 1 << (i % 8);
+        }
+    }
+
+    return RESUME_HEADER_LEN + bitmap_len;
+}
+
+// File chunk PDU seq_num carries: the holes in the agreed bitmap first, then everything past it in order
+uint64_t resume_chunk(struct resume *r, uint64_t seq_num) {
+    uint64_t n = seq_num - START_SEQ_NUM;
+
+    if (n < r->missing_count) {
+        return r->start + r->missing[n];
+    }
+
+    return r->start + r->span + (n - r->missing_count);
+}
+
+// rcopy side: picks up the checkpoint next to output. Without one nothing already in output can be
+// trusted, the transfer starts at chunk 0 and the file is truncated like any other
+void resume_load(struct resume *r, char *output, int32_t buf_size) {
+    uint8_t saved[4 + 4 + RESUME_HEADER_LEN + RESUME_MAX_BITS / 8];
+    uint32_t net_buf_size = 0;
+    int fd = 0;
+    int len = 0;
+
+    memset(r, 0, sizeof(struct resume));
+    snprintf(r->path, RESUME_PATH_LEN, "%s%s", output, RESUME_SUFFIX);
+
+    if ((fd = open(r->path, O_RDONLY)) >= 0) {
+        len = read(fd, saved, sizeof(saved));
+        close(fd);
+
+        // A checkpoint cut at another buffer size says nothing about these chunks
+        memcpy(&net_buf_size, saved + 4, 4);
+        if ((len >= 8 + RESUME_HEADER_LEN) && (memcmp(saved, RESUME_MAGIC, 4) == 0) && (ntohl(net_buf_size) == buf_size)
+            && (resume_decode(r, saved + 8, len - 8, buf_size) == 0)) {
+            snprintf(r->path, RESUME_PATH_LEN, "%s%s", output, RESUME_SUFFIX);
+            r->loaded = 1;
+            return;
+        }
+
+        resume_reset(r);
+    }
+
+    r->active = 1;
+}
+
+// rcopy side: records a written chunk of len bytes, saves a checkpoint every RESUME_INTERVAL chunks
+void resume_mark(struct resume *r, uint64_t chunk, int32_t len, int32_t buf_size) {
+    if (chunk * buf_size + len > r->end) {
+        r->end = chunk * buf_size + len;
+    }
+
+    // Past the bitmap it is simply sent again next time
+    if ((chunk < r->base) || (chunk >= r->base + RESUME_MAX_BITS)) {
+        return;
+    }
+
+    r->bits[(chunk % RESUME_MAX_BITS) / 8] |= 1 << (chunk % 8);
+    resume_advance(r);
+
+    if (++r->since_save >= RESUME_INTERVAL) {
+        resume_save(r, buf_size);
+    }
+}
+
+// rcopy side: length of the finished file. The chunk before the EOF's is the last one: written this run
+// it ends the file at end, written by an earlier run nothing past its chunk belongs to the file
+uint64_t resume_length(struct resume *r, uint64_t eof_seq, int32_t buf_size, uint64_t disk_size) {
+    uint64_t limit = resume_chunk(r, eof_seq) * buf_size;
+
+    if ((limit > 0) && (r->end > limit - buf_size)) {
+        return r->end;
+    }
+
+    return (disk_size < limit) ? disk_size : limit;
+}
+
+// rcopy side: writes the checkpoint now, -1 on failure. Written aside and renamed over
+// so a crash mid-save leaves the previous one
+int resume_save(struct resume *r, int32_t buf_size) {
+    uint8_t saved[4 + 4 + RESUME_HEADER_LEN + RESUME_MAX_BITS / 8];
+    char tmp[RESUME_PATH_LEN + 4];
+    uint32_t net_buf_size = htonl(buf_size);
+    int len = 8;
+    int fd = 0;
+
+    if (r->path[0] == '\0') {
+        return -1;
+    }
+
+    memcpy(saved, RESUME_MAGIC, 4);
+    memcpy(saved + 4, &net_buf_size, 4);
+    len += resume_encode(r, buf_size, saved + 8);
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", r->path);
+    if ((fd = open(tmp, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0) {
+        return -1;
+    }
+    if (write(fd, saved, len) != len) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    close(fd);
+
+    r->since_save = 0;
+    return rename(tmp, r->path);
+}
+
+// rcopy side: the server would not resume, everything is sent again
+void resume_reset(struct resume *r) {
+    char path[RESUME_PATH_LEN];
+
+    memcpy(path, r->path, RESUME_PATH_LEN);
+    free(r->missing);
+    memset(r, 0, sizeof(struct resume));
+    memcpy(r->path, path, RESUME_PATH_LEN);
+}
+
+// rcopy side: transfer complete, the checkpoint goes away
+void resume_finish(struct resume *r) {
+    if (r->path[0] != '\0') {
+        unlink(r->path);
+    }
+}
+
+// Whether chunk is on disk
+static int resume_bit(struct resume *r, uint64_t chunk) {
+    if (chunk < r->base) {
+        return 1;
+    }
+    if (chunk >= r->base + RESUME_MAX_BITS) {
+        return 0;
+    }
+
+    return (r->bits[(chunk % RESUME_MAX_BITS) / 8] >> (chunk % 8)) & 1;
+}
+
+// Moves base past the chunks now contiguous, clearing their bits for reuse
+static void resume_advance(struct resume *r) {
+    while (r->bits[(r->base % RESUME_MAX_BITS) / 8] & (1 << (r->base % 8))) {
+        r->bits[(r->base % RESUME_MAX_BITS) / 8] &= ~(1 << (r->base % 8));
+        r->base++;
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef RESUME_H
+#define RESUME_H
+
+#include <stdint.h>
+
+#define RESUME_MAX_BITS 4096 // Chunks past the contiguous offset a checkpoint records (512 bitmap bytes on the wire)
+#define RESUME_INTERVAL 1024 // Chunks written between checkpoints
+#define RESUME_HEADER_LEN 8 // Option value: contiguous byte offset (8), then the bitmap
+#define RESUME_SUFFIX ".resume" // Checkpoint file, next to the output file
+#define RESUME_PATH_LEN 256
+
+// A resumed transfer only carries the chunks (buffer-size pieces of the file) not on disk yet:
+// PDU n is the n'th of them, both sides map it back to its file offset the same way
+struct resume {
+    int active; // Transfer was negotiated as a resume, offsets come from resume_chunk
+    // The map both sides agreed on
+    uint64_t start; // Every chunk below this was on disk when the transfer started
+    uint32_t span; // Chunks past start the agreed bitmap covers
+    uint32_t missing_count; // Holes in that bitmap, sent first
+    uint32_t *missing; // Their offsets from start
+    // rcopy side: what is on disk now, saved at each checkpoint
+    uint64_t base; // Every chunk below this is written
+    uint8_t bits[RESUME_MAX_BITS / 8]; // Chunk c (base <= c < base + RESUME_MAX_BITS) is written if bit c % RESUME_MAX_BITS is set
+    uint32_t since_save; // Chunks written since the last checkpoint
+    uint64_t end; // Byte just past the furthest chunk written this run
+    int loaded; // Picked up a checkpoint rcopy saved, so what is on disk is kept
+    char path[RESUME_PATH_LEN]; // Checkpoint file, empty when there is none
+};
+
+// Server side: takes rcopy's INIT_OPT_RESUME value, -1 if it doesn't fit buf_size
+int resume_decode(struct resume *r, uint8_t *value, uint16_t len, int32_t buf_size);
+
+// Builds the INIT_OPT_RESUME value from what is on disk now, returns its length
+int resume_encode(struct resume *r, int32_t buf_size, uint8_t *value);
+
+// File chunk PDU seq_num carries
+uint64_t resume_chunk(struct resume *r, uint64_t seq_num);
+
+// rcopy side: picks up the checkpoint next to output, without one the whole file is fetched
+void resume_load(struct resume *r, char *output, int32_t buf_size);
+
+// rcopy side: records a written chunk of len bytes, saves a checkpoint every RESUME_INTERVAL chunks
+void resume_mark(struct resume *r, uint64_t chunk, int32_t len, int32_t buf_size);
+
+// rcopy side: length of the finished file, the EOF came as PDU eof_seq and disk_size is on disk now
+uint64_t resume_length(struct resume *r, uint64_t eof_seq, int32_t buf_size, uint64_t disk_size);
+
+// rcopy side: writes the checkpoint now, -1 on failure
+int resume_save(struct resume *r, int32_t buf_size);
+
+// rcopy side: the server would not resume, everything is sent again
+void resume_reset(struct resume *r);
+
+// rcopy side: transfer complete, the checkpoint goes away
+void resume_finish(struct resume *r);
+
+#endif // RESUME_H
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "rtt.h"
+
+static int64_t rtt_clamp(struct rtt *estimator, int64_t rto);
+
+// Starts at RTO_INITIAL clamped to [min_rto, max_rto]
+void rtt_init(struct rtt *estimator, int64_t min_rto, int64_t max_rto) {
+    estimator->srtt = 0;
+    estimator->rttvar = 0;
+    estimator->min_rto = min_rto;
+    estimator->max_rto = max_rto;
+    estimator->rto = rtt_clamp(estimator, RTO_INITIAL);
+}
+
+// Folds in a new measurement (only from packets sent once - Karn) and recomputes the RTO
+void rtt_sample(struct rtt *estimator, int64_t sample) {
+    if (sample <= 0) {
+        sample = 1;
+    }
+
+    if (estimator->srtt == 0) {
+        // First measurement
+        estimator->srtt = sample;
+        estimator->rttvar = sample / 2;
+    }
+    else {
+        // rttvar = 3/4 rttvar + 1/4 |srtt - sample|, srtt = 7/8 srtt + 1/8 sample
+        int64_t delta = estimator->srtt - sample;
+        if (delta < 0) {
+            delta = -delta;
+        }
+
+        estimator->rttvar = (3 * estimator->rttvar + delta) / 4;
+        estimator->srtt = (7 * estimator->srtt + sample) / 8;
+    }
+
+    // A fresh sample also clears any backoff
+    estimator->rto = rtt_clamp(estimator, estimator->srtt + 4 * estimator->rttvar);
+}
+
+// Doubles the RTO after a timeout
+void rtt_backoff(struct rtt *estimator) {
+    estimator->rto = rtt_clamp(estimator, estimator->rto * 2);
+}
+
+// Drops any backoff once the peer is heard from again (back to the initial RTO without a sample)
+void rtt_restore(struct rtt *estimator) {
+    if (estimator->srtt != 0) {
+        estimator->rto = rtt_clamp(estimator, estimator->srtt + 4 * estimator->rttvar);
+    }
+    else {
+        estimator->rto = rtt_clamp(estimator, RTO_INITIAL);
+    }
+}
+
+// Current timeout in microseconds
+int64_t rtt_timeout(struct rtt *estimator) {
+    return estimator->rto;
+}
+
+// Monotonic clock in microseconds
+int64_t rtt_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static int64_t rtt_clamp(struct rtt *estimator, int64_t rto) {
+    if (rto < estimator->min_rto) {
+        rto = estimator->min_rto;
+    }
+    if (rto > estimator->max_rto) {
+        rto = estimator->max_rto;
+    }
+    return rto;
+}
@@ -0,0 +1,37 @@
+#ifndef RTT_H
+#define RTT_H
+
+#include <stdint.h>
+
+#define RTO_INITIAL 1000000 // 1 second until the first sample (RFC 6298)
+#define RTO_MIN_DEFAULT 10000 // 10 ms floor
+#define RTO_MAX_DEFAULT 4000000 // 4 second ceiling
+
+// Jacobson/Karels round trip estimator (all times in microseconds)
+struct rtt {
+    int64_t srtt; // Smoothed RTT, 0 until the first sample
+    int64_t rttvar; // Mean deviation of the RTT
+    int64_t rto; // Current timeout, doubled by each backoff
+    int64_t min_rto; // Floor
+    int64_t max_rto; // Ceiling
+};
+
+// Starts at RTO_INITIAL clamped to [min_rto, max_rto]
+void rtt_init(struct rtt *estimator, int64_t min_rto, int64_t max_rto);
+
+// Folds in a new measurement (only from packets sent once - Karn) and recomputes the RTO
+void rtt_sample(struct rtt *estimator, int64_t sample);
+
+// Doubles the RTO after a timeout
+void rtt_backoff(struct rtt *estimator);
+
+// Drops any backoff once the peer is heard from again
+void rtt_restore(struct rtt *estimator);
+
+// Current timeout in microseconds
+int64_t rtt_timeout(struct rtt *estimator);
+
+// Monotonic clock in microseconds
+int64_t rtt_now();
+
+#endif // RTT_H
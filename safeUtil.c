@@ -5,10 +5,14 @@
 // Put in system calls with error checking
 // keep the function paramaters same as system call
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <pthread.h>
 
 #include "safeUtil.h"
 #include "cpe464.h"
@@ -16,6 +20,34 @@
 #ifdef __LIBCPE464_
 #endif
 
+// The sendtoErr() library keeps its packet log in globals. Threads either take turns in it, or
+// with no errors to simulate, go straight to the kernel (safeThreads)
+static pthread_mutex_t errLock = PTHREAD_MUTEX_INITIALIZER;
+static int errLocked = 0;
+static int errDirect = 0;
+
+static void errEnter(void)
+{
+	if (errLocked)
+		pthread_mutex_lock(&errLock);
+}
+
+static void errLeave(void)
+{
+	if (errLocked)
+		pthread_mutex_unlock(&errLock);
+}
+
+// Call before starting threads that send. direct skips the library (error rate 0), otherwise
+// its calls are serialized
+void safeThreads(int direct)
+{
+	if (direct)
+		errDirect = 1;
+	else
+		errLocked = 1;
+}
+
 int safeRecvfrom(int socketNum, void * buf, int len, int flags, struct sockaddr *srcAddr, int * addrLen)
 {
 	int returnValue = 0;
@@ -31,7 +63,15 @@ int safeRecvfrom(int socketNum, void * buf, int len, int flags, struct sockaddr
 int safeSendto(int socketNum, void * buf, int len, int flags, struct sockaddr *srcAddr, int addrLen)
 {
 	int returnValue = 0;
-	if ((returnValue = sendtoErr(socketNum, buf, (size_t) len, flags, srcAddr, (socklen_t) addrLen)) < 0)
+
+	errEnter();
+	if (errDirect)
+		returnValue = (sendto)(socketNum, buf, (size_t) len, flags, srcAddr, (socklen_t) addrLen);
+	else
+		returnValue = sendtoErr(socketNum, buf, (size_t) len, flags, srcAddr, (socklen_t) addrLen);
+	errLeave();
+
+	if (returnValue < 0)
 	{
 		perror("sendto: ");
 		exit(-1);
@@ -40,6 +80,70 @@ int safeSendto(int socketNum, void * buf, int len, int flags, struct sockaddr *s
 	return returnValue;
 }
 
+int safeSendmmsg(int socketNum, struct mmsghdr * msgvec, unsigned int vlen, int flags)
+{
+	int returnValue = 0;
+
+	errEnter();
+	if (errDirect)
+		returnValue = (sendmmsg)(socketNum, msgvec, vlen, flags);
+	else
+		returnValue = sendmmsgErr(socketNum, msgvec, vlen, flags);
+	errLeave();
+
+	if (returnValue < 0)
+	{
+		perror("sendmmsg: ");
+		exit(-1);
+	}
+	
+	return returnValue;
+}
+
+// Returns 0 instead of failing when nothing is queued (MSG_DONTWAIT)
+int safeRecvmmsg(int socketNum, struct mmsghdr * msgvec, unsigned int vlen, int flags)
+{
+	int returnValue = 0;
+	if ((returnValue = recvmmsg(socketNum, msgvec, vlen, flags, NULL)) < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			return 0;
+		}
+
+		perror("recvmmsg: ");
+		exit(-1);
+	}
+	
+	return returnValue;
+}
+
+// Returns 0 instead of blocking or failing when nothing is queued
+int safeRecvfromNoWait(int socketNum, void * buf, int len, struct sockaddr *srcAddr, int * addrLen)
+{
+	int returnValue = 0;
+
+	errEnter();
+	if (errDirect)
+		returnValue = (recvfrom)(socketNum, buf, (size_t) len, MSG_DONTWAIT, srcAddr, (socklen_t *) addrLen);
+	else
+		returnValue = recvfrom(socketNum, buf, (size_t) len, MSG_DONTWAIT, srcAddr, (socklen_t *) addrLen);
+	errLeave();
+
+	if (returnValue < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		{
+			return 0;
+		}
+
+		perror("recvfrom: ");
+		exit(-1);
+	}
+	
+	return returnValue;
+}
+
 int safeRecv(int socketNum, void * buf, int len, int flags)
 {
 	int returnValue = 0;
@@ -7,9 +7,14 @@
 #define __SAFEUTIL_H__
 
 struct sockaddr;
+struct mmsghdr;
 
 int safeRecvfrom(int socketNum, void * buf, int len, int flags, struct sockaddr *srcAddr, int * addrLen);
 int safeSendto(int socketNum, void * buf, int len, int flags, struct sockaddr *srcAddr, int addrLen);
+int safeSendmmsg(int socketNum, struct mmsghdr * msgvec, unsigned int vlen, int flags);
+int safeRecvmmsg(int socketNum, struct mmsghdr * msgvec, unsigned int vlen, int flags);
+int safeRecvfromNoWait(int socketNum, void * buf, int len, struct sockaddr *srcAddr, int * addrLen);
+void safeThreads(int direct);
 int safeRecv(int socketNum, void * buf, int len, int flags);
 int safeSend(int socketNum, void * buf, int len, int flags);
 
@@ -15,7 +15,12 @@
 	#include <netinet/in.h>
 	#include <arpa/inet.h>
 	#include <sys/resource.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
 	#include <signal.h>
+	#include <errno.h>
+	#include <sys/epoll.h>
+	#include <pthread.h>
 
 	#include "gethostbyname.h"
 	#include "networks.h"
@@ -24,35 +29,146 @@
 	#include "pollLib.h"
 	#include "pdu.h"
 	#include "window.h"
+	#include "batch.h"
+	#include "rtt.h"
+	#include "cwnd.h"
+	#include "conntab.h"
+	#include "wheel.h"
+	#include "pace.h"
+	#include "fec.h"
+	#include "resume.h"
+	#include "delta.h"
+	#include "compress.h"
+	#include "readahead.h"
 
 	#define MAXBUF 1400
 	#define MAXPDUBUF 1407
 	#define MAX_FILE 100
-	#define START_SEQ_NUM 1
 	#define NOTFILENAME 15
+	#define ACK_PDU_LEN 11 // RR/SREJ/SACK: header and the 4 byte sequence number, a SACK's bitmap follows
 	#define MAX_RETRANS 10
+	#define MAX_WINDOW_BYTES (256 << 20) // Most one session's window slots may take, a bigger window is cut down
+	#define EVENT_RECV_MAX 256 // -e: datagrams taken off the socket per wakeup before the timers run
+	#define EVENT_RCVBUF (8 << 20) // -e: receive buffer of the socket every client shares
 	
 
+	// Optional transfer modes selected on the command line
+	struct ServerOptions
+	{
+		int batch; // -b: one sendmmsg() per window burst, one recvmmsg() per ACK wakeup
+		int gso; // -g: also coalesce full-size PDUs into UDP_SEGMENT super-datagrams
+		int64_t rto_min; // -r: RTO floor (microseconds)
+		int64_t rto_max; // -R: RTO ceiling (microseconds)
+		int cwnd; // -c: AIMD congestion window on top of the flow-control window
+		int pace; // -p: space PDUs out with a token bucket
+		double pace_rate; // Pacing rate in bytes per second, 0 follows the delivery rate
+		int mmap; // -m: map the file, DATA goes out as its header plus a pointer into the mapping
+		int readahead; // -t: a reader thread keeps a ring of chunks read ahead of the sender
+		int events; // -e: one process serves every client from an epoll loop instead of forking per client
+		int workers; // -w: event loop threads, each on its own SO_REUSEPORT socket (0 runs the one loop on the server socket)
+	};
+
+	static struct ServerOptions options;
+
+	// Which share of the file this child sends (striped rcopy runs one session per stripe)
+	struct Stripe
+	{
+		int index; // PDU n of this session is file chunk (n - 1) * count + index
+		int count; // Stripes in the transfer, 0 sends the whole file in order
+	};
+
+	// The file mapped for -m (base is NULL when chunks are read() into a buffer instead)
+	struct SourceMap
+	{
+		uint8_t *base;
+		uint64_t size;
+	};
+
 	typedef enum State STATE;
 
 	enum State
 	{
-		START, DONE, FILENAME, SEND_DATA, WAIT_ON_EOF_ACK, WAIT_ON_ACK, TIMEOUT_ON_ACK, TIMEOUT_ON_EOF_ACK
+		START, DONE, FILENAME, RECV_SIGS, SEND_DATA, WAIT_ON_EOF_ACK, WAIT_ON_ACK, TIMEOUT_ON_ACK, TIMEOUT_ON_EOF_ACK
+	};
+
+	// One transfer: everything a forked child used to keep on its stack, so the -e loop can hold many
+	struct Session
+	{
+		STATE state;
+		struct Connection client;
+		int32_t data_file;
+		int32_t packet_len;
+		int32_t eof_len;
+		int32_t buf_size;
+		int32_t window_size;
+		uint64_t seq_num;
+		uint64_t last_seq_num;
+		struct window window;
+		struct batch sendBatch;
+		struct batch recvBatch;
+		struct rtt rtt;
+		struct cwnd cc;
+		struct pacer pace;
+		struct fec_encoder fec;
+		int fec_k;
+		int finished; // Indiates EOF has been transmitted (Window is Closed)
+		int32_t data_packet_len;
+		int32_t final_packet_len;
+		uint64_t final_packet_seq;
+		struct Stripe stripe;
+		struct resume resume; // Chunks a resumed rcopy still needs (resume.active is 0 for a full transfer)
+		struct delta_encoder delta; // Delta stream against rcopy's old file (delta.active is 0 for a plain transfer)
+		struct compressor zip; // Deflates the chunks for rcopy -z (zip.active is 0 for a plain transfer)
+		struct SourceMap source;
+		struct readahead ahead; // Chunks read ahead of the sender for -t (active is 0 when send_data reads them itself)
+		int retries; // -e: timeouts in a row with nothing from the client
+		int64_t deadline; // -e: when the session's timer fires (rtt_now() clock)
+		struct wheel_timer timer; // -e: the same deadline on the loop's wheel
 	};
 
+	// The transfer being worked on: the child's only one, or the one this thread's -e loop is handling right now
+	static __thread struct Session *session;
+
 	void process_client(int32_t serverSocketNumber, uint8_t *buf, int32_t recv_len, struct Connection * server);
 	void process_server(int serverSocketNumber, float error_rate);
+	void process_events(int serverSocketNumber, float error_rate);
+	void process_workers(int portNumber, float error_rate);
+	void *event_worker(void *arg);
+	void event_loop(int serverSocketNumber);
+	struct Session *session_new(struct Connection * client);
+	STATE session_start(struct Session *s, uint8_t *buf, int32_t recv_len);
+	void session_datagram(struct Session *s, uint8_t *buf, int32_t len, uint8_t *packet);
+	void session_timeout(struct Session *s, uint8_t *packet);
+	void session_run(struct Session *s, uint8_t *packet);
+	void session_settle(struct Session *s, struct conntab *table, struct wheel *timers);
+	void session_end(struct Session *s);
 	int checkArgs(int argc, char *argv[]);
+	void printUsage(char *name);
 	void handleZombies(int sig);
-	STATE wait_on_ack(struct Connection * client, struct window* input_window, uint32_t *last_seq_num, int32_t packet_len, uint32_t * seq_num, int * finished, int32_t *data_packet_len, int32_t * final_packet_len, int32_t * final_packet_seq);
-	STATE processSelect(struct Connection *connection, int *retryCount, STATE TimeoutState, STATE DataState, STATE DoneState, struct window* input_window, int * finished);
-	STATE filename(struct Connection * client, uint8_t * buf, int32_t recv_len, int32_t * data_file, int32_t * buf_size, int32_t * window_size, struct window *serverWindow, int32_t *data_packet_len);
-	STATE wait_on_eof_ack(struct Connection * client, struct window* input_window, uint32_t last_seq_num, int32_t *eof_len);
-	STATE timeout_on_ack(struct Connection * client, uint8_t * packet, struct window *serverWindow, int32_t *data_packet_len, int32_t * final_packet_len, int32_t * final_packet_seq);
+	int send_blocked(struct window* input_window, struct cwnd *cc);
+	STATE wait_on_ack(struct Connection * client, struct window* input_window, uint64_t *last_seq_num, int32_t packet_len, uint64_t * seq_num, int * finished, int32_t *data_packet_len, int32_t * final_packet_len, uint64_t * final_packet_seq, struct rtt *rtt, struct cwnd *cc, struct pacer *pace, struct fec_encoder *fec);
+	STATE wait_on_ack_batch(struct Connection * client, struct window* input_window, uint64_t *last_seq_num, int32_t packet_len, uint64_t * seq_num, int * finished, int32_t *data_packet_len, int32_t * final_packet_len, uint64_t * final_packet_seq, struct batch *recvBatch, struct rtt *rtt, struct cwnd *cc, struct pacer *pace, struct fec_encoder *fec);
+	STATE ack_packet(struct Connection * client, struct window* input_window, uint8_t *buf, int32_t len, uint8_t flag, uint64_t * cur_seq, int * finished, int32_t *data_packet_len, int32_t * final_packet_len, uint64_t * final_packet_seq, struct rtt *rtt, struct cwnd *cc, struct pacer *pace, struct fec_encoder *fec);
+	STATE processSelect(struct Connection *connection, int *retryCount, STATE TimeoutState, STATE DataState, STATE DoneState, struct window* input_window, int * finished, struct rtt *rtt, struct cwnd *cc);
+	STATE filename(struct Connection * client, uint8_t * buf, int32_t recv_len, int32_t * data_file, int32_t * buf_size, int32_t * window_size, struct window *serverWindow, int32_t *data_packet_len, int *fec_k);
+	int window_open(struct window *serverWindow, int32_t data_file, int32_t window_size, int32_t data_packet_len);
+	STATE wait_on_eof_ack(struct Connection * client, struct window* input_window, uint64_t last_seq_num, int32_t *eof_len, struct rtt *rtt);
+	STATE timeout_on_ack(struct Connection * client, uint8_t * packet, struct window *serverWindow, int32_t *data_packet_len, int32_t * final_packet_len, uint64_t * final_packet_seq, struct cwnd *cc);
 	STATE timeout_on_eof_ack (struct Connection * client, uint8_t * packet, int32_t packet_len);
-	STATE send_srej(struct Connection * client, struct window* input_window, uint8_t *srej_packet, uint32_t data_packet_len, uint32_t * seq_num, int32_t * final_packet_len, int32_t * final_packet_seq);
+	int32_t path_payload(struct Connection * client);
+	off_t chunk_offset(uint64_t seq_num, int buf_size);
+	int32_t read_chunk(int32_t data_file, uint8_t *buf, int buf_size, uint64_t seq_num);
+	void map_source(int32_t data_file);
+	uint8_t *map_chunk(uint64_t seq_num, int buf_size, int32_t *len);
+	void retransmit(struct Connection * client, struct window* input_window, uint64_t seq_num, uint8_t flag);
+	STATE recv_sigs(struct Connection * client, int32_t data_file, struct rtt *rtt);
+	STATE sigs_packet(struct Connection * client, int32_t data_file, uint8_t *buf, int32_t len, uint8_t flag);
+	STATE send_srej(struct Connection * client, struct window* input_window, uint8_t *srej_packet, uint32_t data_packet_len, uint64_t * seq_num, int32_t * final_packet_len, uint64_t * final_packet_seq, struct cwnd *cc, struct fec_encoder *fec);
+	int resend_packet(struct Connection * client, struct window* input_window, uint64_t resend_seq, uint32_t data_packet_len, uint64_t * seq_num, int32_t * final_packet_len, uint64_t * final_packet_seq);
+	void handle_sack(struct Connection * client, struct window* input_window, uint8_t *sack_packet, int32_t sack_len, uint32_t data_packet_len, uint64_t * seq_num, int32_t * final_packet_len, uint64_t * final_packet_seq, struct rtt *rtt, struct cwnd *cc, struct fec_encoder *fec);
 	STATE send_data (struct Connection *client, uint8_t * packet, int32_t * packet_len, int32_t 
-	data_file, int buf_size, uint32_t * seq_num, uint32_t *last_seq_num, struct window *serverWindow, int32_t *eof_len, int * finished, int32_t *data_packet_len, int32_t * final_packet_len, int32_t * final_packet_seq);
+	data_file, int buf_size, uint64_t * seq_num, uint64_t *last_seq_num, struct window *serverWindow, int32_t *eof_len, int * finished, int32_t *data_packet_len, int32_t * final_packet_len, uint64_t * final_packet_seq, struct cwnd *cc, struct pacer *pace, struct fec_encoder *fec);
+	STATE send_data_batch (struct Connection *client, uint8_t * packet, int32_t * packet_len, int32_t data_file, int buf_size, uint64_t * seq_num, uint64_t *last_seq_num, struct window *serverWindow, int32_t *eof_len, int * finished, int32_t *data_packet_len, int32_t * final_packet_len, uint64_t * final_packet_seq, struct batch *sendBatch, struct cwnd *cc, struct pacer *pace, struct fec_encoder *fec);
 
 
 	// // Main control for server processes
@@ -104,52 +220,51 @@
 
 	void process_client(int32_t serverSocketNumber, uint8_t *buf, int32_t recv_len, struct Connection * client) 
 	{
-		STATE state = START;
-		int32_t data_file = 0;
-		int32_t packet_len = 0;
-		int32_t eof_len = 0;
-		uint8_t packet[MAXPDUBUF];
-		int32_t buf_size = 0;
-		int32_t window_size = 0;
-		uint32_t seq_num = START_SEQ_NUM;
-		uint32_t last_seq_num = 0;
-		struct window *serverWindow = (struct window *) calloc(1, sizeof(struct window));
+		uint8_t packet[MAX_PDU];
+		struct Session *s = session_new(client);
 
-		int finished = 0; // Indiates EOF has been transmitted (Window is Closed)
-		int32_t data_packet_len = 0;
-		int32_t final_packet_len = 0;
-		int32_t final_packet_seq = 0;
+		session = s;
 
-		while (state != DONE)
+		while (s->state != DONE)
 		{
-			switch (state)
+			switch (s->state)
 			{
 				case START:
-					state = FILENAME;
+					s->state = FILENAME;
 					break;
 				
 				case FILENAME:
-					state = filename(client, buf, recv_len, &data_file, &buf_size, &window_size, serverWindow, &data_packet_len);
+					s->state = session_start(s, buf, recv_len);
 					break;
 				
+				case RECV_SIGS:
+					s->state = recv_sigs(&s->client, s->data_file, &s->rtt);
+					break;
+
 				case SEND_DATA:
-					state = send_data(client, packet, &packet_len, data_file, buf_size, &seq_num, &last_seq_num, serverWindow, &eof_len, &finished, &data_packet_len, &final_packet_len, &final_packet_seq);
+					if (options.batch)
+						s->state = send_data_batch(&s->client, packet, &s->packet_len, s->data_file, s->buf_size, &s->seq_num, &s->last_seq_num, &s->window, &s->eof_len, &s->finished, &s->data_packet_len, &s->final_packet_len, &s->final_packet_seq, &s->sendBatch, &s->cc, &s->pace, &s->fec);
+					else
+						s->state = send_data(&s->client, packet, &s->packet_len, s->data_file, s->buf_size, &s->seq_num, &s->last_seq_num, &s->window, &s->eof_len, &s->finished, &s->data_packet_len, &s->final_packet_len, &s->final_packet_seq, &s->cc, &s->pace, &s->fec);
 					break;
 
 				case WAIT_ON_ACK:
-					state = wait_on_ack(client, serverWindow, &last_seq_num, packet_len, &seq_num, &finished, &data_packet_len, &final_packet_len, &final_packet_seq);
+					if (options.batch)
+						s->state = wait_on_ack_batch(&s->client, &s->window, &s->last_seq_num, s->packet_len, &s->seq_num, &s->finished, &s->data_packet_len, &s->final_packet_len, &s->final_packet_seq, &s->recvBatch, &s->rtt, &s->cc, &s->pace, &s->fec);
+					else
+						s->state = wait_on_ack(&s->client, &s->window, &s->last_seq_num, s->packet_len, &s->seq_num, &s->finished, &s->data_packet_len, &s->final_packet_len, &s->final_packet_seq, &s->rtt, &s->cc, &s->pace, &s->fec);
 					break;
 
 				case WAIT_ON_EOF_ACK:
-					state = wait_on_eof_ack(client, serverWindow, last_seq_num, &eof_len);
+					s->state = wait_on_eof_ack(&s->client, &s->window, s->last_seq_num, &s->eof_len, &s->rtt);
 					break;
 
 				case TIMEOUT_ON_ACK:
-					state = timeout_on_ack(client, packet, serverWindow, &data_packet_len, &final_packet_len, &final_packet_seq);
+					s->state = timeout_on_ack(&s->client, packet, &s->window, &s->data_packet_len, &s->final_packet_len, &s->final_packet_seq, &s->cc);
 					break;
 				
 				case TIMEOUT_ON_EOF_ACK:
-					state = timeout_on_eof_ack(client, packet, packet_len);
+					s->state = timeout_on_eof_ack(&s->client, packet, s->packet_len);
 					break;
 
 				case DONE:
@@ -159,39 +274,401 @@
 		}
 	}
 
+	// A session for the client at client->address, still to read its FILENAME_INIT
+	struct Session *session_new(struct Connection * client)
+	{
+		struct Session *s = (struct Session *) sCalloc(1, sizeof(struct Session));
+
+		s->state = START;
+		s->client = *client;
+		s->seq_num = START_SEQ_NUM;
+		s->data_file = -1;
+		rtt_init(&s->rtt, options.rto_min, options.rto_max);
+		wheel_timer_init(&s->timer, s);
 
-	// Retransmission of lowest packet in window
-	STATE timeout_on_ack(struct Connection * client, uint8_t * packet, struct window *serverWindow, int32_t *data_packet_len, int32_t * final_packet_len, int32_t * final_packet_seq) 
+		return s;
+	}
+
+	// Takes the FILENAME_INIT in buf and sets the transfer up, returns the state it starts in
+	STATE session_start(struct Session *s, uint8_t *buf, int32_t recv_len)
 	{
-		// Resent lowest packet in window buffer
-		uint8_t flag = DATA_TIMEOUT;
-		uint8_t *retransmission = window_get_lower(serverWindow);
+		STATE state = filename(&s->client, buf, recv_len, &s->data_file, &s->buf_size, &s->window_size, &s->window, &s->data_packet_len, &s->fec_k);
 
+		// Refused, nothing else to set up
+		if (state == DONE)
+			return state;
+
+		cwnd_init(&s->cc, s->window_size);
+		pacer_init(&s->pace, options.pace_rate, PACE_BURST_PDUS * s->data_packet_len);
+		fec_encoder_init(&s->fec, s->fec_k, s->buf_size, s->window_size);
+
+		// One message slot for every PDU the window can hold
+		if (options.batch)
+		{
+			batch_create(&s->sendBatch, s->window_size);
+
+			// -e reads the shared socket in its own loop
+			if (!options.events)
+				batch_create_recv(&s->recvBatch, s->window_size, MAXPDUBUF);
+
+			// Every full DATA PDU is 7 + buf_size, the kernel splits on that.
+			// Segments larger than the path MTU would be refused
+			if (options.gso && ((path_payload(&s->client) <= 0) || (s->buf_size <= path_payload(&s->client))))
+				batch_enable_gso(&s->sendBatch, s->client.sk_num, s->data_packet_len);
+		}
+
+		return state;
+	}
+
+
+	// -e: one process serves every client from the server socket
+	void process_events(int serverSocketNumber, float error_rate)
+	{
+		printf("Error: %f\n", error_rate);
+		sendErr_init(error_rate, DROP_ON, FLIP_ON, DEBUG_ON, RSEED_ON);
+
+		event_loop(serverSocketNumber);
+	}
+
+	// -w: one event loop thread per socket, every socket bound to the port with SO_REUSEPORT. The kernel
+	// hashes a client's address to one socket, so each session only ever sees its own worker
+	void process_workers(int portNumber, float error_rate)
+	{
+		struct sockaddr_in6 address;
+		socklen_t addressLen = sizeof(address);
+		int *sockets = (int *) sCalloc(options.workers, sizeof(int));
+		pthread_t *threads = (pthread_t *) sCalloc(options.workers, sizeof(pthread_t));
+
+		// The first socket settles the port when the OS picks it, the rest join it there
+		sockets[0] = udpServerSetupReuse(portNumber);
+		getsockname(sockets[0], (struct sockaddr *)&address, &addressLen);
+		portNumber = ntohs(address.sin6_port);
+		printf("Server using Port #: %d (%d workers)\n", portNumber, options.workers);
+
+		for (int i = 1; i < options.workers; i++)
+			sockets[i] = udpServerSetupReuse(portNumber);
+
+		// Once for the whole process. The library isn't thread safe: workers take turns in it, or
+		// with nothing to drop or flip, send and receive without it
+		printf("Error: %f\n", error_rate);
+		sendErr_init(error_rate, DROP_ON, FLIP_ON, DEBUG_ON, RSEED_ON);
+		safeThreads(error_rate == 0);
+
+		for (int i = 0; i < options.workers; i++)
+		{
+			if (pthread_create(&threads[i], NULL, event_worker, &sockets[i]) != 0)
+			{
+				perror("pthread_create");
+				exit(-1);
+			}
+		}
+
+		for (int i = 0; i < options.workers; i++)
+			pthread_join(threads[i], NULL);
+	}
+
+	// -w: a worker thread, nothing in its loop is shared with the other workers
+	void *event_worker(void *arg)
+	{
+		event_loop(*(int *)arg);
+		return NULL;
+	}
+
+	// Serves every client whose datagrams arrive on serverSocketNumber. Datagrams go to the session of the
+	// address they came from, and the earliest session timer (RTO or pacing gap) bounds each wait
+	void event_loop(int serverSocketNumber)
+	{
+		struct conntab table; // Every transfer in progress, by client address
+		struct wheel timers; // Their timers
+		struct wheel_timer *timer = NULL;
+		struct Session *s = NULL;
+		struct epoll_event event;
+		struct timespec timeout;
+		struct sockaddr_in6 address;
+		int addressLen = 0;
+		uint8_t buf[MAXPDUBUF];
+		uint8_t packet[MAX_PDU]; // Scratch for the PDU being built, the window keeps its own copy
+		uint8_t flag = 0;
 		uint32_t seq_num = 0;
-		memcpy(&seq_num, retransmission, 4);
-		seq_num = ntohl(seq_num);
-		// printf("Retransmitting Seq: %d\n", seq_num);
+		int32_t len = 0;
+		int64_t now = 0;
+		int64_t wait = 0;
+		int rcvbuf = EVENT_RCVBUF;
+		int epollFd = epoll_create1(0);
+
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.fd = serverSocketNumber;
+		if ((epollFd < 0) || (epoll_ctl(epollFd, EPOLL_CTL_ADD, serverSocketNumber, &event) < 0))
+		{
+			perror("epoll");
+			exit(-1);
+		}
 
-		uint32_t new_packet_len = 0;
-		if (seq_num == *final_packet_seq) {
-			new_packet_len = *final_packet_len;
+		// Every client's ACKs queue on this one socket now
+		setsockopt(serverSocketNumber, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+		conntab_init(&table);
+		wheel_init(&timers, rtt_now());
+
+		while (1)
+		{
+			// Sleep until the earliest timer, with no sessions until a client shows up
+			now = rtt_now();
+			if ((wait = wheel_next(&timers)) >= 0)
+				wait = (wait > now) ? wait - now : 0;
+
+			timeout.tv_sec = wait / 1000000;
+			timeout.tv_nsec = (wait % 1000000) * 1000;
+			if ((epoll_pwait2(epollFd, &event, 1, (wait < 0) ? NULL : &timeout, NULL) < 0) && (errno != EINTR))
+			{
+				perror("epoll_pwait2");
+				exit(-1);
+			}
+
+			// What is queued, a bounded number at a time so the timers still get their turn
+			for (int i = 0; i < EVENT_RECV_MAX; i++)
+			{
+				addressLen = sizeof(address);
+				if ((len = safeRecvfromNoWait(serverSocketNumber, buf, MAXPDUBUF, (struct sockaddr *)&address, &addressLen)) == 0)
+					break;
+
+				// The protocol has no connection ID, a client is its address and port
+				if ((s = conntab_find(&table, &address, 0)) != NULL)
+				{
+					session = s;
+					session_datagram(s, buf, len, packet);
+					session_settle(s, &table, &timers);
+					continue;
+				}
+
+				// Only a good FILENAME_INIT opens a session, anything else from a stranger is left
+				getHeader(buf, &flag, &seq_num);
+				if ((len < NOTFILENAME) || (in_cksum((unsigned short *)buf, len) != 0) || (flag != FILENAME_INIT))
+					continue;
+
+				struct Connection client;
+				client.sk_num = serverSocketNumber;
+				client.address = address;
+
+				s = session_new(&client);
+				conntab_add(&table, &s->client.address, 0, s);
+
+				session = s;
+				s->state = session_start(s, buf, len);
+				session_run(s, packet);
+				session_settle(s, &table, &timers);
+			}
+
+			// Every timer due by now, the ones the timeouts arm again wait for the next pass
+			now = rtt_now();
+			while ((timer = wheel_expired(&timers, now)) != NULL)
+			{
+				s = timer->data;
+				session = s;
+				session_timeout(s, packet);
+				session_settle(s, &table, &timers);
+			}
 		}
-		else {
-			new_packet_len = *data_packet_len;
+	}
+
+	// -e: after a session has run, its timer moves to its new deadline, or a finished session gives
+	// everything back. Nothing can reach it after that, it is off the table and the wheel
+	void session_settle(struct Session *s, struct conntab *table, struct wheel *timers)
+	{
+		if (s->state == DONE)
+		{
+			wheel_cancel(timers, &s->timer);
+			conntab_remove(table, &s->client.address, 0);
+			session_end(s);
+			return;
 		}
 
+		wheel_arm(timers, &s->timer, s->deadline);
+	}
 
-		memcpy(retransmission + 6, &flag, 1);
+	// -e: one datagram from the session's client, handled the way the forked child's wait states would
+	void session_datagram(struct Session *s, uint8_t *buf, int32_t len, uint8_t *packet)
+	{
+		uint8_t flag = 0;
+		uint32_t seq_num = 0;
 
-		// Recalculate checksum
-		uint16_t checksum = 0;
-		memcpy(retransmission + 4, &checksum, 2); // Clear old checksum
-		checksum = in_cksum((unsigned short *)retransmission, new_packet_len); // Calculate new checksum
-		memcpy(retransmission + seqNumLen, &checksum, chkSumLen);
+		getHeader(buf, &flag, &seq_num);
+
+		// rcopy sent its FILENAME_INIT again, the DATA already on the way answers it
+		if (flag == FILENAME_INIT)
+			return;
+
+		switch (s->state)
+		{
+			case RECV_SIGS:
+				s->retries = 0;
+				s->state = sigs_packet(&s->client, s->data_file, buf, len, flag);
+				break;
+
+			case WAIT_ON_ACK:
+				s->retries = 0;
+				s->state = ack_packet(&s->client, &s->window, buf, len, flag, &s->seq_num, &s->finished, &s->data_packet_len, &s->final_packet_len, &s->final_packet_seq, &s->rtt, &s->cc, &s->pace, &s->fec);
+				break;
+
+			case WAIT_ON_EOF_ACK:
+				// Anything else has the EOF sent again
+				if (in_cksum((unsigned short *)buf, len) != 0)
+					s->retries++;
+				else if (flag == EOF_ACK)
+					s->state = DONE;
+				break;
 
-		// printf("%d\n", serverWindow->lower);
+			default:
+				break;
+		}
+
+		session_run(s, packet);
+	}
+
+	// -e: the session's timer went off
+	void session_timeout(struct Session *s, uint8_t *packet)
+	{
+		switch (s->state)
+		{
+			case WAIT_ON_ACK:
+				// Window still open, it was only the pacer's gap
+				if ((send_blocked(&s->window, &s->cc) == 0) && !s->finished)
+				{
+					s->state = SEND_DATA;
+					break;
+				}
 
-		safeSendto(client->sk_num, retransmission, new_packet_len, 0, (struct sockaddr *)&client->address, sizeof(client->address));
+				if (++s->retries > MAX_RETRANS)
+				{
+					printf("Sent data %d times, no ACK, client is probably gone\n", MAX_RETRANS);
+					s->state = DONE;
+					return;
+				}
+
+				rtt_backoff(&s->rtt);
+
+				// Nothing came back for a whole RTO, restart slow start
+				if (options.cwnd)
+					cwnd_timeout(&s->cc, s->window.current - s->window.lower, s->window.current);
+				s->state = TIMEOUT_ON_ACK;
+				break;
+
+			case RECV_SIGS:
+				rtt_backoff(&s->rtt);
+				if (++s->retries > MAX_RETRANS)
+				{
+					printf("No signatures for %d timeouts, client is probably gone\n", MAX_RETRANS);
+					s->state = DONE;
+					return;
+				}
+				break;
+
+			case WAIT_ON_EOF_ACK:
+				rtt_backoff(&s->rtt);
+				s->retries++;
+				break;
+
+			default:
+				break;
+		}
+
+		session_run(s, packet);
+	}
+
+	// -e: sends what the session may send now, then arms its timer for whatever it waits on next
+	void session_run(struct Session *s, uint8_t *packet)
+	{
+		int64_t delay = 0;
+
+		while (1)
+		{
+			switch (s->state)
+			{
+				case SEND_DATA:
+					if (options.batch)
+						s->state = send_data_batch(&s->client, packet, &s->packet_len, s->data_file, s->buf_size, &s->seq_num, &s->last_seq_num, &s->window, &s->eof_len, &s->finished, &s->data_packet_len, &s->final_packet_len, &s->final_packet_seq, &s->sendBatch, &s->cc, &s->pace, &s->fec);
+					else
+						s->state = send_data(&s->client, packet, &s->packet_len, s->data_file, s->buf_size, &s->seq_num, &s->last_seq_num, &s->window, &s->eof_len, &s->finished, &s->data_packet_len, &s->final_packet_len, &s->final_packet_seq, &s->cc, &s->pace, &s->fec);
+					break;
+
+				case WAIT_ON_ACK:
+					// Window still open: keep sending, or wait out the pacer
+					if ((send_blocked(&s->window, &s->cc) == 0) && !s->finished)
+					{
+						if (!options.pace || ((delay = pacer_delay(&s->pace, s->data_packet_len)) <= 0))
+						{
+							s->state = SEND_DATA;
+							break;
+						}
+
+						s->deadline = rtt_now() + delay;
+						return;
+					}
+
+					s->deadline = rtt_now() + rtt_timeout(&s->rtt);
+					return;
+
+				case TIMEOUT_ON_ACK:
+					s->state = timeout_on_ack(&s->client, packet, &s->window, &s->data_packet_len, &s->final_packet_len, &s->final_packet_seq, &s->cc);
+					break;
+
+				case WAIT_ON_EOF_ACK:
+					if (s->retries > MAX_RETRANS - 1)
+					{
+						printf("Sent data %d times, no ACK, client is probably gone\n", MAX_RETRANS);
+						s->state = DONE;
+						return;
+					}
+
+					safeSendto(s->client.sk_num, window_get_packet(&s->window, s->last_seq_num), s->eof_len, 0, (struct sockaddr *)&s->client.address, sizeof(s->client.address));
+					s->deadline = rtt_now() + rtt_timeout(&s->rtt);
+					return;
+
+				case RECV_SIGS:
+					s->deadline = rtt_now() + rtt_timeout(&s->rtt);
+					return;
+
+				default:
+					return;
+			}
+		}
+	}
+
+	// -e: a finished session gives back its file, reader and buffers
+	void session_end(struct Session *s)
+	{
+		printf("Done\n");
+
+		readahead_stop(&s->ahead);
+		if (s->source.base != NULL)
+			munmap(s->source.base, s->source.size);
+		if (s->data_file >= 0)
+			close(s->data_file);
+
+		free(s->resume.missing);
+		delta_encoder_free(&s->delta);
+		compress_free(&s->zip);
+		fec_encoder_free(&s->fec);
+		batch_free(&s->sendBatch);
+		batch_free(&s->recvBatch);
+		window_free(&s->window);
+		free(s);
+	}
+
+
+	// Retransmission of lowest packet in window
+	STATE timeout_on_ack(struct Connection * client, uint8_t * packet, struct window *serverWindow, int32_t *data_packet_len, int32_t * final_packet_len, uint64_t * final_packet_seq, struct cwnd *cc) 
+	{
+		// Resent lowest packet in window buffer
+		uint8_t *retransmission = window_get_lower(serverWindow);
+
+		uint32_t net_seq = 0;
+		memcpy(&net_seq, retransmission, 4);
+		uint64_t seq_num = seq_expand(ntohl(net_seq), serverWindow->lower);
+		// printf("Retransmitting Seq: %d\n", seq_num);
+
+		retransmit(client, serverWindow, seq_num, DATA_TIMEOUT);
+		window_stamp(serverWindow, seq_num, rtt_now(), 1);
 
 
 
@@ -206,35 +683,113 @@
 	}
 
 
-	STATE filename(struct Connection * client, uint8_t * buf, int32_t recv_len, int32_t * data_file, int32_t * buf_size, int32_t * window_size, struct window *serverWindow, int32_t *data_packet_len)
+	// Largest payload that crosses the path to the client unfragmented, 0 if the MTU is unknown
+	int32_t path_payload(struct Connection * client)
+	{
+		int mtu = getPathMtu(&client->address);
+		int overhead = IN6_IS_ADDR_V4MAPPED(&client->address.sin6_addr) ? 20 + 8 : 40 + 8; // IP + UDP
+
+		if (mtu <= 0)
+			return 0;
+
+		return mtu - overhead - 7;
+	}
+
+
+	STATE filename(struct Connection * client, uint8_t * buf, int32_t recv_len, int32_t * data_file, int32_t * buf_size, int32_t * window_size, struct window *serverWindow, int32_t *data_packet_len, int *fec_k)
 	{
-		uint32_t seqNum = 0; 
+		uint64_t seqNum = 0; 
 		int fileNameLen = 0;
 
 		uint8_t response[1];
 		char fname[MAX_FILE];
 		STATE returnValue = DONE;
 
-		// Extract Buffer Size
+		// Extract Buffer Size (0 asks for the largest PDU the path takes without fragmenting)
 		memcpy(buf_size, buf + 7, 4);
 		*buf_size = ntohl(*buf_size);
+
+		if (*buf_size <= 0)
+		{
+			*buf_size = path_payload(client);
+			if (*buf_size <= 0)
+				*buf_size = MAXBUF;
+		}
+		if (*buf_size > MAX_PAYLOAD)
+			*buf_size = MAX_PAYLOAD;
+
 		*data_packet_len = 7 + *buf_size;
 
 		// Extract Window Size
 		memcpy(window_size, buf+ 11, 4);
 		*window_size = ntohl(*window_size);
 
-		// Extrace File Name
-		memcpy(fname, buf + NOTFILENAME, recv_len - NOTFILENAME);
-		int fileLen = recv_len - NOTFILENAME;
+		// Cut down like the buffer size and echoed, every slot can take a full PDU
+		if (*window_size > MAX_WINDOW_BYTES / *data_packet_len)
+			*window_size = MAX_WINDOW_BYTES / *data_packet_len;
+
+		// Extrace File Name, options follow it after a NUL
+		int fileLen = strnlen((char *)buf + NOTFILENAME, recv_len - NOTFILENAME);
+		if (fileLen >= MAX_FILE)
+			fileLen = MAX_FILE - 1;
+		memcpy(fname, buf + NOTFILENAME, fileLen);
 		fname[fileLen] = '\0';
 
-		// Create socket associated with client
-		client->sk_num = safeGetUdpSocket();
-		
-		// Setup Poll table for poll()
-		setupPollSet();
-		addToPollSet(client->sk_num);
+		uint8_t *opts = buf + NOTFILENAME + fileLen + 1;
+		int optsLen = recv_len - NOTFILENAME - fileLen - 1;
+		uint16_t optLen = 0;
+		uint8_t *opt = NULL;
+
+		// Parity group size rcopy asked for, cut down to what its window can rebuild from
+		*fec_k = 0;
+		if ((opt = init_opt_find(opts, optsLen, INIT_OPT_FEC, &optLen)) != NULL && (optLen == 2))
+		{
+			uint16_t net_k = 0;
+			memcpy(&net_k, opt, 2);
+			*fec_k = fec_negotiate(ntohs(net_k), *window_size);
+		}
+
+		// Striped rcopy: this session only carries every count'th chunk
+		uint8_t *stripeOpt = init_opt_find(opts, optsLen, INIT_OPT_STRIPE, &optLen);
+		if ((stripeOpt != NULL) && (optLen == 4))
+		{
+			uint16_t net_stripe[2];
+			memcpy(net_stripe, stripeOpt, sizeof(net_stripe));
+			session->stripe.index = ntohs(net_stripe[0]);
+			session->stripe.count = ntohs(net_stripe[1]);
+
+			if (session->stripe.index >= session->stripe.count)
+				session->stripe.count = 0;
+		}
+
+		// Resuming rcopy: skip what it already has (a stripe's chunks don't line up with its bitmap)
+		uint8_t *resumeOpt = init_opt_find(opts, optsLen, INIT_OPT_RESUME, &optLen);
+		if ((resumeOpt != NULL) && (session->stripe.count == 0))
+			resume_decode(&session->resume, resumeOpt, optLen, *buf_size);
+
+		// Delta rcopy: its old file's signatures come next, then a delta against them instead of the file
+		uint8_t *deltaOpt = init_opt_find(opts, optsLen, INIT_OPT_DELTA, &optLen);
+		if ((deltaOpt != NULL) && (optLen == 8) && (session->stripe.count == 0) && !session->resume.active)
+		{
+			uint32_t net_delta[2];
+			memcpy(net_delta, deltaOpt, sizeof(net_delta));
+			delta_encoder_init(&session->delta, ntohl(net_delta[0]), ntohl(net_delta[1]));
+		}
+
+		// Compressing rcopy: chunks that shrink go out deflated at the level it asked for
+		uint8_t *zipOpt = init_opt_find(opts, optsLen, INIT_OPT_COMPRESS, &optLen);
+		if ((zipOpt != NULL) && (optLen == 1))
+			compress_init(&session->zip, zipOpt[0], *buf_size);
+
+		// Create socket associated with client (-e answers every client from the server socket)
+		if (!options.events)
+		{
+			client->sk_num = safeGetUdpSocket();
+			
+			// Setup Poll table for poll()
+			setupPollSet();
+			addToPollSet(client->sk_num);
+		}
 		
 		if (((*data_file) = open(fname, O_RDONLY)) < 0) 
 		{
@@ -242,31 +797,210 @@
 			returnValue = DONE;
 		}
 
+		// A window the request can't have only ends this session, -e/-w serve every other client from this process
+		else if ((*window_size <= 0) || (window_open(serverWindow, *data_file, *window_size, *data_packet_len) < 0))
+		{
+			printf("Refusing window of %d PDUs\n", *window_size);
+			send_buf(response, fileNameLen, client, FNAME_BAD, &seqNum, buf);
+			returnValue = DONE;
+		}
+
 		else 
 		{
-			send_buf(response, fileNameLen, client, FNAME_OK, &seqNum, buf);
-			returnValue = SEND_DATA;
+			// Echo the buffer size and window actually used so rcopy sizes its slots to match, and the agreed parity group size
+			uint8_t ok[MAXBUF];
+			uint32_t net_buf_size = htonl(*buf_size);
+			uint32_t net_window = htonl(*window_size);
+			uint16_t net_k = htons(*fec_k);
+			int okLen = sizeof(net_buf_size);
+
+			memcpy(ok, &net_buf_size, sizeof(net_buf_size));
+			okLen += init_opt_add(ok + okLen, 0, INIT_OPT_WINDOW, &net_window, sizeof(net_window));
+			if (opt != NULL)
+				okLen += init_opt_add(ok + okLen, 0, INIT_OPT_FEC, &net_k, sizeof(net_k));
+			if (session->stripe.count != 0)
+				okLen += init_opt_add(ok + okLen, 0, INIT_OPT_STRIPE, stripeOpt, 4);
+			if (session->resume.active)
+				okLen += init_opt_add(ok + okLen, 0, INIT_OPT_RESUME, resumeOpt, RESUME_HEADER_LEN);
+			if (session->delta.active)
+				okLen += init_opt_add(ok + okLen, 0, INIT_OPT_DELTA, deltaOpt, 8);
+			if (session->zip.active)
+				okLen += init_opt_add(ok + okLen, 0, INIT_OPT_COMPRESS, zipOpt, 1);
+
+			send_buf(ok, okLen, client, FNAME_OK, &seqNum, buf);
+			returnValue = session->delta.active ? RECV_SIGS : SEND_DATA;
+
+			// Only a plain transfer reads the file front to back, the rest stay with read_chunk
+			if (options.readahead && (session->source.base == NULL) && !session->delta.active && (session->stripe.count == 0) && !session->resume.active
+				&& (readahead_start(&session->ahead, *data_file, *buf_size) < 0))
+				printf("Read-ahead unavailable, reading inline\n");
 		}
 
-		// Initialize Window Buffer
-		window_create(serverWindow, *window_size);
-		// window_print(serverWindow);
-		
 		return returnValue;
 	}
 
-	STATE send_data (struct Connection *client, uint8_t * packet, int32_t * packet_len, int32_t data_file, int buf_size, uint32_t * seq_num, uint32_t *last_seq_num,  struct window *serverWindow, int32_t *eof_len, int * finished, int32_t *data_packet_len, int32_t * final_packet_len, int32_t * final_packet_seq)
+	// Maps the source and initializes the window buffer, -1 if the window can't be allocated. Mapped chunks
+	// only leave their header in a slot, only compressed payloads (and the one byte EOF) still need room
+	int window_open(struct window *serverWindow, int32_t data_file, int32_t window_size, int32_t data_packet_len)
+	{
+		int32_t slot_len = data_packet_len;
+
+		map_source(data_file);
+		if ((session->source.base != NULL) && !session->zip.active)
+			slot_len = PDU_HEADER_LEN + 1;
+
+		return window_create(serverWindow, window_size, slot_len);
+	}
+
+	// Where the chunk PDU seq_num carries starts: the next one in order, or with stripes or a resume its own place
+	off_t chunk_offset(uint64_t seq_num, int buf_size)
+	{
+		if (session->resume.active)
+			return (off_t)resume_chunk(&session->resume, seq_num) * buf_size;
+
+		if (session->stripe.count == 0)
+			return (off_t)(seq_num - START_SEQ_NUM) * buf_size;
+
+		off_t chunk = (off_t)(seq_num - START_SEQ_NUM) * session->stripe.count + session->stripe.index;
+		return chunk * buf_size;
+	}
+
+	// Reads the payload of PDU seq_num: the next chunk of the file, or with stripes or a resume the chunk at its own offset
+	int32_t read_chunk(int32_t data_file, uint8_t *buf, int buf_size, uint64_t seq_num)
+	{
+		if (session->delta.active)
+			return delta_read(&session->delta, buf, buf_size);
+
+		if ((session->stripe.count == 0) && !session->resume.active)
+			return read(data_file, buf, buf_size);
+
+		return pread(data_file, buf, buf_size, chunk_offset(seq_num, buf_size));
+	}
+
+	// -m: maps the file so DATA payloads go out straight from it. A delta stream is built rather than
+	// read and an empty file can't be mapped, those keep read_chunk
+	void map_source(int32_t data_file)
+	{
+		struct stat st;
+		void *base = NULL;
+
+		if (!options.mmap || session->delta.active || (fstat(data_file, &st) < 0) || (st.st_size == 0))
+			return;
+
+		if ((base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, data_file, 0)) == MAP_FAILED)
+		{
+			perror("mmap, reading the file instead");
+			return;
+		}
+
+		// A plain transfer walks it front to back, stripes and resumes jump around
+		if ((session->stripe.count == 0) && !session->resume.active)
+			madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+		session->source.base = base;
+		session->source.size = st.st_size;
+	}
+
+	// -m: the chunk PDU seq_num carries, inside the mapping (len gets its length, 0 past the end of the file)
+	uint8_t *map_chunk(uint64_t seq_num, int buf_size, int32_t *len)
+	{
+		uint64_t offset = chunk_offset(seq_num, buf_size);
+
+		*len = 0;
+		if (offset >= session->source.size)
+			return session->source.base;
+
+		*len = (session->source.size - offset < (uint64_t)buf_size) ? (int32_t)(session->source.size - offset) : buf_size;
+		return session->source.base + offset;
+	}
+
+	// Takes rcopy's block signatures, each DELTA_SIG is RR'd with the next index wanted. Moves on to
+	// the data once all are in, rcopy takes the first DATA as the last RR if that one is lost
+	STATE recv_sigs(struct Connection * client, int32_t data_file, struct rtt *rtt)
 	{
 		uint8_t buf[MAXPDUBUF];
+		uint8_t flag = 0;
+		uint32_t seq_num = 0;
+		int32_t len = 0;
+		static int retryCount = 0;
+
+		if (pollCallMicro(rtt_timeout(rtt)) == -1)
+		{
+			rtt_backoff(rtt);
+			if (++retryCount > MAX_RETRANS)
+			{
+				printf("No signatures for %d timeouts, client is probably gone\n", MAX_RETRANS);
+				return DONE;
+			}
+			return RECV_SIGS;
+		}
+		retryCount = 0;
+
+		len = recv_buf(buf, MAXPDUBUF, client->sk_num, client, &flag, &seq_num);
+
+		return sigs_packet(client, data_file, buf, len, flag);
+	}
+
+	// Handles one datagram while the signatures come in, returns the state to go on in
+	STATE sigs_packet(struct Connection * client, int32_t data_file, uint8_t *buf, int32_t len, uint8_t flag)
+	{
+		uint8_t packet[MAXPDUBUF];
+		uint64_t seqNum = 0;
+
+		if ((len == CRC_ERROR) || (in_cksum((unsigned short *)buf, len) != 0) || (flag != DELTA_SIG))
+			return RECV_SIGS;
+
+		delta_sigs_add(&session->delta, buf + 7, len - 7);
+
+		uint32_t net_next = htonl(session->delta.received);
+		send_buf((uint8_t *)&net_next, sizeof(net_next), client, RR, &seqNum, packet);
+
+		if (session->delta.received < session->delta.block_count)
+			return RECV_SIGS;
+
+		if (delta_encoder_start(&session->delta, data_file) < 0)
+		{
+			perror("delta");
+			return DONE;
+		}
+
+		return SEND_DATA;
+	}
+
+	STATE send_data (struct Connection *client, uint8_t * packet, int32_t * packet_len, int32_t data_file, int buf_size, uint64_t * seq_num, uint64_t *last_seq_num,  struct window *serverWindow, int32_t *eof_len, int * finished, int32_t *data_packet_len, int32_t * final_packet_len, uint64_t * final_packet_seq, struct cwnd *cc, struct pacer *pace, struct fec_encoder *fec)
+	{
+		uint8_t buf[MAX_PDU];
+		uint8_t *chunk = buf;
 		int32_t len_read = 0;
+		int64_t delay = 0;
 		STATE returnValue = DONE;
 
-		// Check if window is full
-		if (window_full(serverWindow) == 1) {
+		uint8_t *payload = NULL;
+		int32_t payload_len = 0;
+		uint8_t flag = DATA;
+		struct iovec iov[BATCH_MAX_IOV];
+
+		uint8_t *parity = NULL;
+		int32_t parity_len = 0;
+
+		// Check if window (or congestion window) is full
+		if (send_blocked(serverWindow, cc) == 1) {
 			return WAIT_ON_ACK; // Wait for RR
 		}
 
-		len_read = read(data_file, buf, buf_size);
+		// Hold the PDU until the bucket has tokens for it, an ACK showing up in the meantime goes first.
+		// -e never sleeps here, the loop comes back when the bucket has refilled
+		if (options.pace && (delay = pacer_delay(pace, *data_packet_len)) > 0) {
+			if (options.events || (pollCallMicro(delay) != -1))
+				return WAIT_ON_ACK;
+		}
+
+		if (session->source.base != NULL)
+			chunk = map_chunk(*seq_num, buf_size, &len_read);
+		else if (session->ahead.active)
+			chunk = readahead_next(&session->ahead, &len_read);
+		else
+			len_read = read_chunk(data_file, buf, buf_size, *seq_num);
 
 		buf[buf_size] = '\0';
 
@@ -279,8 +1013,14 @@
 			case (0):
 				if (!(*finished)) 
 				{
+					// Last partial parity group goes out ahead of the EOF
+					if ((parity_len = fec_flush(fec, &parity)) > 0)
+						safeSendto(client->sk_num, parity, parity_len, 0, (struct sockaddr *)&client->address, sizeof(client->address));
+
 					(*packet_len) = send_buf(buf, 1, client, END_OF_FILE, seq_num, packet);
 					window_add(serverWindow, *seq_num, packet, *packet_len);
+					window_stamp(serverWindow, *seq_num, rtt_now(), 0);
+					pacer_consume(pace, *packet_len);
 					window_CURUpdate(serverWindow);
 					// window_print(serverWindow);
 
@@ -294,20 +1034,45 @@
 				break;
 			default:
 
-				(*packet_len) = send_buf(buf, len_read, client, DATA, seq_num, packet);
+				// Chunks that shrink go out deflated, the rest as they are. The first one never is:
+				// an rcopy that lost FNAME_OK learns the buffer size from it
+				if ((*seq_num != START_SEQ_NUM) && (payload_len = compress_chunk(&session->zip, chunk, len_read, &payload)) > 0)
+					flag = DATA | PDU_COMPRESSED;
+				else {
+					payload = chunk;
+					payload_len = len_read;
+				}
+
+				// Store sent packet into buffer until receiving RR. A chunk still in the mapping is
+				// sent from there, only its header is built and kept
+				if ((session->source.base != NULL) && (payload == chunk)) {
+					(*packet_len) = createPDUHeader(packet, *seq_num, flag, payload, payload_len);
+					window_add_mapped(serverWindow, *seq_num, packet, payload, *packet_len);
+					send_gather(iov, window_iov(serverWindow, *seq_num, iov), client);
+				}
+				else {
+					(*packet_len) = send_buf(payload, payload_len, client, flag, seq_num, packet);
+					window_add(serverWindow, *seq_num, packet, *packet_len);
+				}
 				// printPDU(packet, *packet_len);
 				
-				// Store final packet length that may not be size of buffer
-				if (*packet_len != *data_packet_len) {
+				// Store final packet length that may not be size of buffer (only the last chunk is short, compressed PDUs are too)
+				if (len_read != buf_size) {
 					*final_packet_len = *packet_len;
 					*final_packet_seq = *seq_num;
 				}
 
-				// Store sent packet into buffer until receiving RR
-				window_add(serverWindow, *seq_num, packet, *packet_len);
+				window_stamp(serverWindow, *seq_num, rtt_now(), 0);
+				pacer_consume(pace, *packet_len);
 				window_CURUpdate(serverWindow);
 				// window_print(serverWindow);
 
+				// Parity goes out right behind the PDU that closes its group
+				if ((parity_len = fec_add(fec, flag, payload, payload_len, *seq_num, &parity)) > 0) {
+					safeSendto(client->sk_num, parity, parity_len, 0, (struct sockaddr *)&client->address, sizeof(client->address));
+					pacer_consume(pace, parity_len);
+				}
+
 				// Increment Sequence Number
 				(*seq_num)++;
 
@@ -318,76 +1083,229 @@
 		return returnValue;
 	}
 
-	STATE wait_on_ack(struct Connection * client, struct window* input_window, uint32_t *last_seq_num, int32_t packet_len, uint32_t * cur_seq, int * finished, int32_t *data_packet_len, int32_t * final_packet_len, int32_t * final_packet_seq)
+	// Fills every open slot of the window, then sends the whole burst with one sendmmsg()
+	STATE send_data_batch (struct Connection *client, uint8_t * packet, int32_t * packet_len, int32_t data_file, int buf_size, uint64_t * seq_num, uint64_t *last_seq_num, struct window *serverWindow, int32_t *eof_len, int * finished, int32_t *data_packet_len, int32_t * final_packet_len, uint64_t * final_packet_seq, struct batch *sendBatch, struct cwnd *cc, struct pacer *pace, struct fec_encoder *fec)
 	{
-		STATE returnValue = DONE;
-		uint32_t crc_check = 0;
-		uint8_t buf[MAXPDUBUF];
-		uint32_t len = MAXPDUBUF;
-		uint8_t flag = 0;
-		uint32_t seq_num = 0;
-		static int retryCount = 0;
-
-
-		// Check for timeout
-		if ((returnValue = processSelect(client, &retryCount, TIMEOUT_ON_ACK, SEND_DATA, DONE, input_window, finished
-		)) == SEND_DATA)
+		uint8_t buf[MAX_PDU];
+		uint8_t *chunk = buf;
+		int32_t len_read = 0;
+		int64_t delay = 0;
+		uint8_t *parity = NULL;
+		int32_t parity_len = 0;
+		uint8_t *payload = NULL;
+		int32_t payload_len = 0;
+		uint8_t flag = DATA;
+		struct iovec iov[BATCH_MAX_IOV];
+		int iov_count = 0;
+
+		while ((send_blocked(serverWindow, cc) == 0) && !(*finished))
 		{
+			// Out of tokens: let the queued PDUs go, then sleep until the bucket refills or an ACK shows up
+			if (options.pace && (delay = pacer_delay(pace, *data_packet_len)) > 0)
+			{
+				send_batch(sendBatch, client);
+
+				if (options.events || (pollCallMicro(delay) != -1))
+					return WAIT_ON_ACK;
+			}
 
-			// Receive RR buffer from client
-			crc_check = recv_buf(buf, len, client->sk_num, client, &flag, &seq_num);
+			if (session->source.base != NULL)
+				chunk = map_chunk(*seq_num, buf_size, &len_read);
+			else if (session->ahead.active)
+				chunk = readahead_next(&session->ahead, &len_read);
+			else
+				len_read = read_chunk(data_file, buf, buf_size, *seq_num);
 
-			// Check for flipped bits/corrupted packets
-			if (in_cksum((unsigned short *)buf, crc_check) != 0) 
+			if (len_read < 0)
 			{
-				return WAIT_ON_ACK; // Ignore incorrect packet and continue waiting for initial packet.
+				perror("send_data_batch, read error");
+				return DONE;
 			}
+			else if (len_read == 0)
+			{
+				// Last partial parity group goes out ahead of the EOF
+				if ((parity_len = fec_flush(fec, &parity)) > 0)
+					batch_add(sendBatch, parity, parity_len, client);
 
+				(*packet_len) = createPDU(packet, *seq_num, END_OF_FILE, buf, 1);
+				window_add(serverWindow, *seq_num, packet, *packet_len);
+				window_CURUpdate(serverWindow);
 
-		
-			if(crc_check == CRC_ERROR)
-			{
-				returnValue = WAIT_ON_ACK;
+				*last_seq_num = *seq_num; // Retrieve last sequence number for reference
+				*eof_len = *packet_len;
+				*finished = 1;
 			}
-			else if (flag == SREJ)
+			else
 			{
-				if (*finished == 0) {
-					send_srej(client, input_window, buf, *data_packet_len, cur_seq, final_packet_len, final_packet_seq);				
-					returnValue = SEND_DATA;
+				// Chunks that shrink go out deflated, the rest as they are (never the first, see send_data)
+				flag = DATA;
+				if ((*seq_num != START_SEQ_NUM) && (payload_len = compress_chunk(&session->zip, chunk, len_read, &payload)) > 0)
+					flag = DATA | PDU_COMPRESSED;
+				else {
+					payload = chunk;
+					payload_len = len_read;
+				}
+
+				// Store packet into buffer until receiving RR, a chunk still in the mapping only leaves its header
+				if ((session->source.base != NULL) && (payload == chunk)) {
+					(*packet_len) = createPDUHeader(packet, *seq_num, flag, payload, payload_len);
+					window_add_mapped(serverWindow, *seq_num, packet, payload, *packet_len);
 				}
 				else {
-					send_srej(client, input_window, buf, *data_packet_len, cur_seq, final_packet_len, final_packet_seq);				
-					returnValue = SEND_DATA;
+					(*packet_len) = createPDU(packet, *seq_num, flag, payload, payload_len);
+					window_add(serverWindow, *seq_num, packet, *packet_len);
 				}
+
+				// Store final packet length that may not be size of buffer (only the last chunk is short, compressed PDUs are too)
+				if (len_read != buf_size) {
+					*final_packet_len = *packet_len;
+					*final_packet_seq = *seq_num;
+				}
+
+				window_CURUpdate(serverWindow);
 			}
-			else if (flag == EOF_ACK)
+
+			window_stamp(serverWindow, *seq_num, rtt_now(), 0);
+			pacer_consume(pace, *packet_len);
+
+			// Queue what the window holds (header + mapping for a mapped chunk), packet gets reused next pass.
+			// Short PDUs (final, EOF, compressed) never join a GSO run
+			iov_count = window_iov(serverWindow, *seq_num, iov);
+			if ((*finished) || (*packet_len != *data_packet_len))
+				batch_addv(sendBatch, iov, iov_count, client);
+			else
+				batch_add_segmentv(sendBatch, iov, iov_count, client);
+
+			// Parity queues right behind the PDU that closes its group, its buffer lasts until the batch is sent
+			if (!(*finished) && ((parity_len = fec_add(fec, flag, payload, payload_len, *seq_num, &parity)) > 0))
 			{
-				printf("\nFinished Transmission\n");
-				returnValue = DONE;
+				batch_add(sendBatch, parity, parity_len, client);
+				pacer_consume(pace, parity_len);
 			}
-			else if (flag != RR)
-			{
-				printf("In wait_on_ack but its not an RR flag (this should never happen) is: %d\n", flag);
-				returnValue = DONE;
+
+			if (!(*finished))
+				(*seq_num)++;
+		}
+
+		send_batch(sendBatch, client);
+
+		return WAIT_ON_ACK;
+	}
+
+	STATE wait_on_ack(struct Connection * client, struct window* input_window, uint64_t *last_seq_num, int32_t packet_len, uint64_t * cur_seq, int * finished, int32_t *data_packet_len, int32_t * final_packet_len, uint64_t * final_packet_seq, struct rtt *rtt, struct cwnd *cc, struct pacer *pace, struct fec_encoder *fec)
+	{
+		STATE returnValue = DONE;
+		int32_t len = 0;
+		uint8_t buf[MAXPDUBUF];
+		uint8_t flag = 0;
+		uint32_t seq_num = 0;
+		static int retryCount = 0;
+
+		// Paced sender came here with the window still open and nothing queued, go back to sending
+		if ((send_blocked(input_window, cc) == 0) && !(*finished) && (pollCall(0) == -1))
+			return SEND_DATA;
+
+		// Check for timeout
+		if ((returnValue = processSelect(client, &retryCount, TIMEOUT_ON_ACK, SEND_DATA, DONE, input_window, finished, rtt, cc)) != SEND_DATA)
+		{
+			return returnValue;
+		}
+
+		// Receive RR buffer from client
+		len = recv_buf(buf, MAXPDUBUF, client->sk_num, client, &flag, &seq_num);
+
+		return ack_packet(client, input_window, buf, len, flag, cur_seq, finished, data_packet_len, final_packet_len, final_packet_seq, rtt, cc, pace, fec);
+	}
+
+	// Handles one RR/SREJ/SACK/EOF_ACK from the client, returns the state to go on in
+	STATE ack_packet(struct Connection * client, struct window* input_window, uint8_t *buf, int32_t len, uint8_t flag, uint64_t * cur_seq, int * finished, int32_t *data_packet_len, int32_t * final_packet_len, uint64_t * final_packet_seq, struct rtt *rtt, struct cwnd *cc, struct pacer *pace, struct fec_encoder *fec)
+	{
+		STATE returnValue = SEND_DATA;
+
+		// Check for flipped bits/corrupted packets
+		if (in_cksum((unsigned short *)buf, len) != 0) 
+		{
+			return WAIT_ON_ACK; // Ignore incorrect packet and continue waiting for initial packet.
+		}
+
+		// Too short to carry its sequence number, whatever sat in buf past it would be read as one
+		if (((flag == RR) || (flag == SREJ) || (flag == SACK)) && (len < ACK_PDU_LEN))
+		{
+			return WAIT_ON_ACK;
+		}
+
+
+	
+		if(len == CRC_ERROR)
+		{
+			returnValue = WAIT_ON_ACK;
+		}
+		else if (flag == SREJ)
+		{
+			if (*finished == 0) {
+				send_srej(client, input_window, buf, *data_packet_len, cur_seq, final_packet_len, final_packet_seq, cc, fec);				
+				returnValue = SEND_DATA;
 			}
+			else {
+				send_srej(client, input_window, buf, *data_packet_len, cur_seq, final_packet_len, final_packet_seq, cc, fec);				
+				returnValue = SEND_DATA;
+			}
+		}
+		else if (flag == SACK)
+		{
+			// Resend the holes, the cumulative part is handled like an RR below
+			handle_sack(client, input_window, buf, len, *data_packet_len, cur_seq, final_packet_len, final_packet_seq, rtt, cc, fec);
+			returnValue = SEND_DATA;
+		}
+		else if (flag == EOF_ACK)
+		{
+			printf("\nFinished Transmission\n");
+			returnValue = DONE;
+		}
+		else if (flag == DELTA_SIG)
+		{
+			// rcopy missed the last signature RR, the DATA it is getting now tells it
+			returnValue = WAIT_ON_ACK;
+		}
+		else if (flag != RR)
+		{
+			printf("In wait_on_ack but its not an RR flag (this should never happen) is: %d\n", flag);
+			returnValue = DONE;
 		}
 
 
 		// Successful Transmission
-		if ((returnValue == SEND_DATA) && (flag == RR))
+		if ((returnValue == SEND_DATA) && ((flag == RR) || (flag == SACK)))
 		{
-			uint32_t rr_seq = 0;
-			memcpy(&rr_seq, buf+7, 4);
-			rr_seq = ntohl(rr_seq);	
+			uint32_t net_rr = 0;
+			memcpy(&net_rr, buf+7, 4);
+			uint64_t rr_seq = seq_expand(ntohl(net_rr), input_window->lower);
 
-			if (rr_seq == *final_packet_seq + 1) 
+			if ((rr_seq == *final_packet_seq + 1) && *finished) 
 			{
 				// printf("Penis\n");
 				return WAIT_ON_EOF_ACK;
 			}		
 
-			window_slide(input_window, rr_seq);
-			window_remove(input_window, rr_seq);
+			// RR acknowledges rr_seq - 1, time it if it was only sent once (Karn)
+			int64_t sent_time = window_sent_time(input_window, rr_seq - 1);
+			if (sent_time != 0)
+			{
+				rtt_sample(rtt, rtt_now() - sent_time);
+			}
+
+			if (options.cwnd && (rr_seq > input_window->lower))
+				cwnd_ack(cc, rr_seq - input_window->lower);
+
+			if (options.pace && (rr_seq > input_window->lower))
+				pacer_delivered(pace, (int64_t)(rr_seq - input_window->lower) * (*data_packet_len), rtt->srtt);
+
+			// A late RR must not drag the window back
+			if (rr_seq >= input_window->lower)
+			{
+				window_slide(input_window, rr_seq);
+				window_remove(input_window, rr_seq);
+			}
 			// window_print(input_window);
 		}
 		
@@ -398,56 +1316,227 @@
 
 	}
 
-	STATE send_srej(struct Connection * client, struct window* input_window, uint8_t *srej_packet, uint32_t data_packet_len, uint32_t * seq_num, int32_t * final_packet_len, int32_t * final_packet_seq) {
-		uint8_t flag = SREJ_RETRAN;
-		uint32_t packet_len = 0;
+	// Drains every queued RR/SREJ with one recvmmsg() and handles the whole burst in one pass
+	STATE wait_on_ack_batch(struct Connection * client, struct window* input_window, uint64_t *last_seq_num, int32_t packet_len, uint64_t * cur_seq, int * finished, int32_t *data_packet_len, int32_t * final_packet_len, uint64_t * final_packet_seq, struct batch *recvBatch, struct rtt *rtt, struct cwnd *cc, struct pacer *pace, struct fec_encoder *fec)
+	{
+		STATE returnValue = DONE;
+		uint8_t *buf = NULL;
+		int32_t len = 0;
+		uint8_t flag = 0;
+		uint32_t seq_num = 0;
+		uint64_t highest_rr = 0;
+		static int retryCount = 0;
+
+		// Paced sender came here with the window still open and nothing queued, go back to sending
+		if ((send_blocked(input_window, cc) == 0) && !(*finished) && (pollCall(0) == -1))
+			return SEND_DATA;
+
+		// Check for timeout
+		if ((returnValue = processSelect(client, &retryCount, TIMEOUT_ON_ACK, SEND_DATA, DONE, input_window, finished, rtt, cc)) != SEND_DATA)
+		{
+			return returnValue;
+		}
+
+		int count = recv_batch(recvBatch, client);
+
+		for (int i = 0; i < count; i++)
+		{
+			buf = batch_get(recvBatch, i, &len);
+			getHeader(buf, &flag, &seq_num);
+
+			// Skip flipped bits/corrupted packets, and acks too short to carry their sequence number
+			if (in_cksum((unsigned short *)buf, len) != 0)
+			{
+				continue;
+			}
+			if (((flag == RR) || (flag == SREJ) || (flag == SACK)) && (len < ACK_PDU_LEN))
+			{
+				continue;
+			}
 
+			if (flag == SREJ)
+			{
+				send_srej(client, input_window, buf, *data_packet_len, cur_seq, final_packet_len, final_packet_seq, cc, fec);
+			}
+			else if (flag == EOF_ACK)
+			{
+				printf("\nFinished Transmission\n");
+				return DONE;
+			}
+			else if (flag == DELTA_SIG)
+			{
+				continue; // rcopy missed the last signature RR, the DATA it is getting now tells it
+			}
+			else if ((flag == RR) || (flag == SACK))
+			{
+				uint32_t net_rr = 0;
+
+				// Resend the holes, the cumulative part is handled like an RR
+				if (flag == SACK)
+					handle_sack(client, input_window, buf, len, *data_packet_len, cur_seq, final_packet_len, final_packet_seq, rtt, cc, fec);
+
+				memcpy(&net_rr, buf+7, 4);
+				uint64_t rr_seq = seq_expand(ntohl(net_rr), input_window->lower);
+
+				if ((rr_seq == *final_packet_seq + 1) && *finished)
+				{
+					return WAIT_ON_EOF_ACK;
+				}
+
+				// RRs are cumulative, only the newest one matters
+				if (rr_seq > highest_rr)
+				{
+					highest_rr = rr_seq;
+				}
+			}
+			else
+			{
+				printf("In wait_on_ack but its not an RR flag (this should never happen) is: %d\n", flag);
+				return DONE;
+			}
+		}
+
+		if (highest_rr > input_window->lower)
+		{
+			// RR acknowledges highest_rr - 1, time it if it was only sent once (Karn)
+			int64_t sent_time = window_sent_time(input_window, highest_rr - 1);
+			if (sent_time != 0)
+			{
+				rtt_sample(rtt, rtt_now() - sent_time);
+			}
+
+			if (options.cwnd)
+				cwnd_ack(cc, highest_rr - input_window->lower);
+
+			if (options.pace)
+				pacer_delivered(pace, (int64_t)(highest_rr - input_window->lower) * (*data_packet_len), rtt->srtt);
+
+			window_slide(input_window, highest_rr);
+			window_remove(input_window, highest_rr);
+		}
+
+		return SEND_DATA;
+	}
+
+	STATE send_srej(struct Connection * client, struct window* input_window, uint8_t *srej_packet, uint32_t data_packet_len, uint64_t * seq_num, int32_t * final_packet_len, uint64_t * final_packet_seq, struct cwnd *cc, struct fec_encoder *fec) {
 		// Get sequence number SREJ'd
-		uint32_t srej_seq = 0;
-		memcpy(&srej_seq, srej_packet + 7, 4);
-		srej_seq = ntohl(srej_seq);
+		uint32_t net_srej = 0;
+		memcpy(&net_srej, srej_packet + 7, 4);
+		uint64_t srej_seq = seq_expand(ntohl(net_srej), input_window->lower);
 
 		// printf("\nSREJ_SEQ: %d\n", srej_seq);
 
-		uint8_t *retransmission = window_get_packet(input_window, srej_seq);
-		memcpy(retransmission + 6, &flag, 1);
-		
-		printPacket(retransmission, 12);
+		// A hole means the path dropped something, back off once per window
+		if (options.cwnd)
+			cwnd_loss(cc, srej_seq, input_window->current);
+		fec_loss(fec, 1);
+
+		if (resend_packet(client, input_window, srej_seq, data_packet_len, seq_num, final_packet_len, final_packet_seq) == 0)
+			return SEND_DATA;
+
+		return WAIT_ON_ACK;
+	}
+
+	// Retransmits one packet out of the window, returns 0 if it hasn't been sent the first time yet
+	int resend_packet(struct Connection * client, struct window* input_window, uint64_t resend_seq, uint32_t data_packet_len, uint64_t * seq_num, int32_t * final_packet_len, uint64_t * final_packet_seq)
+	{
+		// printf("Sending SREJ with %d\n", resend_seq);
+		// printf("Current: %d\n", *seq_num);
+		if (resend_seq == *seq_num)
+			return 0;
 
+		retransmit(client, input_window, resend_seq, SREJ_RETRAN);
+		window_stamp(input_window, resend_seq, rtt_now(), 1);
 
-		if (srej_seq == *final_packet_seq)
+		return 1;
+	}
+
+	// Sends packet seq_num out of its slot again under flag (PDU_COMPRESSED carries over), with the checksum redone
+	void retransmit(struct Connection * client, struct window* input_window, uint64_t seq_num, uint8_t flag)
+	{
+		struct iovec iov[BATCH_MAX_IOV];
+		int iov_count = window_iov(input_window, seq_num, iov);
+		uint8_t *retransmission = iov[0].iov_base;
+		uint16_t checksum = 0;
+
+		// The EOF goes out as an EOF again, rcopy would write a timed-out EOF's byte as file data
+		if (retransmission[6] == END_OF_FILE)
+			flag = END_OF_FILE;
+		flag |= retransmission[6] & PDU_COMPRESSED;
+		memcpy(retransmission + 6, &flag, 1);
+		memcpy(retransmission + seqNumLen, &checksum, chkSumLen); // Clear old checksum
+
+		// Whole PDU in the slot, or its header with the payload still in the mapping
+		if (iov_count == 1)
 		{
-			packet_len = *final_packet_len;
+			checksum = in_cksum((unsigned short *)retransmission, iov[0].iov_len);
+			memcpy(retransmission + seqNumLen, &checksum, chkSumLen);
+			safeSendto(client->sk_num, retransmission, iov[0].iov_len, 0, (struct sockaddr *)&client->address, sizeof(client->address));
 		}
-		else {
-			packet_len = data_packet_len;
+		else
+		{
+			checksum = pdu_cksum(retransmission, iov[1].iov_base, iov[1].iov_len);
+			memcpy(retransmission + seqNumLen, &checksum, chkSumLen);
+			send_gather(iov, iov_count, client);
 		}
+	}
 
+	// Retransmits every hole a SACK reports in one pass. Holes resent less than an srtt ago are
+	// skipped, their retransmission is most likely still in flight
+	void handle_sack(struct Connection * client, struct window* input_window, uint8_t *sack_packet, int32_t sack_len, uint32_t data_packet_len, uint64_t * seq_num, int32_t * final_packet_len, uint64_t * final_packet_seq, struct rtt *rtt, struct cwnd *cc, struct fec_encoder *fec)
+	{
+		uint32_t net_ack = 0;
+		uint8_t *bitmap = sack_packet + ACK_PDU_LEN;
+		int32_t bits = (sack_len - ACK_PDU_LEN) * 8;
+		int32_t last = -1;
+		int loss = 0;
 
-		// Recalculate checksum
-		uint16_t checksum = 0;
-		memcpy(retransmission + 4, &checksum, 2); // Clear old checksum
-		checksum = in_cksum((unsigned short *)retransmission, packet_len); // Calculate new checksum
-		memcpy(retransmission + seqNumLen, &checksum, chkSumLen);
-		
-		// printf("Sending SREJ with %d (%d)\n", srej_seq, packet_len);
-		// printf("Current: %d\n", *seq_num);
-		if (srej_seq == *seq_num)
-			return SEND_DATA;
+		// The bitmap is only as long as the PDU, a SACK without its cumulative ack says nothing
+		if (sack_len < ACK_PDU_LEN)
+			return;
 
-		
-		// printf("data_packet: %d\n", packet_len);
-		// printf("final packet: %d\n", final_packet_len);
-		// printf("final seq: %d\n", final_packet_seq);
-		safeSendto(client->sk_num, retransmission, packet_len, 0, (struct sockaddr *)&client->address, sizeof(client->address));
+		memcpy(&net_ack, sack_packet + 7, 4);
+		uint64_t cum_ack = seq_expand(ntohl(net_ack), input_window->lower);
 
-		return WAIT_ON_ACK;
+		// Highest PDU the receiver holds, everything missing below it is a hole
+		for (int32_t i = 0; i < bits; i++)
+		{
+			if (bitmap[i / 8] & (0x80 >> (i % 8)))
+				last = i;
+		}
 
+		if (last < 0)
+			return;
 
-		
+		int64_t now = rtt_now();
+		int64_t holdoff = (rtt->srtt != 0) ? rtt->srtt : rtt_timeout(rtt);
+
+		// Bit i covers cum_ack + 1 + i, cum_ack itself is always missing
+		for (int32_t i = -1; i < last; i++)
+		{
+			uint64_t hole = cum_ack + 1 + i;
+
+			if ((i >= 0) && (bitmap[i / 8] & (0x80 >> (i % 8))))
+				continue;
+
+			if ((hole < input_window->lower) || (hole >= input_window->current))
+				continue;
+
+			loss++;
+
+			if (now - window_last_sent(input_window, hole) < holdoff)
+				continue;
+
+			resend_packet(client, input_window, hole, data_packet_len, seq_num, final_packet_len, final_packet_seq);
+		}
+
+		// All the holes in one SACK are one congestion event
+		if (options.cwnd && loss)
+			cwnd_loss(cc, cum_ack, input_window->current);
+		fec_loss(fec, loss);
 	}
 
-	STATE wait_on_eof_ack(struct Connection * client, struct window* input_window, uint32_t last_seq_num, int32_t *eof_len)
+	STATE wait_on_eof_ack(struct Connection * client, struct window* input_window, uint64_t last_seq_num, int32_t *eof_len, struct rtt *rtt)
 	{
 		uint32_t crc_check = 0;
 		uint8_t buf[MAXPDUBUF];
@@ -469,8 +1558,9 @@
 
 			safeSendto(client->sk_num, eof_packet, *eof_len, 0, (struct sockaddr *)&client->address, sizeof(client->address));
 			
-			if (pollCall(1000) == -1)
+			if (pollCallMicro(rtt_timeout(rtt)) == -1)
 			{
+				rtt_backoff(rtt);
 				retryCount++;
 				continue;
 			} 
@@ -501,10 +1591,20 @@
 		int portNumber = 0;
 
 		portNumber = checkArgs(argc, argv);	// Check if command call format is correct
+
+		// Workers bind their own sockets
+		if (options.workers > 0)
+		{
+			process_workers(portNumber, atof(argv[1]));
+			return 0;
+		}
 			
 		serverSocketNumber = udpServerSetup(portNumber); // Setup UDP server
 
-		process_server(serverSocketNumber, atof(argv[1]));
+		if (options.events)
+			process_events(serverSocketNumber, atof(argv[1]));
+		else
+			process_server(serverSocketNumber, atof(argv[1]));
 		
 		return 0;
 	}
@@ -515,21 +1615,114 @@
 	{
 		// Checks args and returns port number
 		int portNumber = 0;
+		int optionStart = 2;
+		int opt = 0;
 
-		if (argc > 3 || argc < 2)
+		if (argc < 2)
 		{
-			fprintf(stderr, "Usage %s [error rate] [optional port number]\n", argv[0]);
+			printUsage(argv[0]);
 			exit(-1);
 		}
 		
-		if (argc == 3)
+		if ((argc > 2) && (argv[2][0] != '-'))
 		{
 			portNumber = atoi(argv[2]);
+			optionStart = 3;
+		}
+
+		// Optional flags come after the positional arguments
+		options.rto_min = RTO_MIN_DEFAULT;
+		options.rto_max = RTO_MAX_DEFAULT;
+
+		opterr = 0;
+		while ((opt = getopt(argc - optionStart + 1, argv + optionStart - 1, "bcegmp:r:R:tw:")) != -1)
+		{
+			switch (opt)
+			{
+				case 'b':
+					options.batch = 1;
+					break;
+
+				case 'c':
+					options.cwnd = 1;
+					break;
+
+				case 'e':
+					options.events = 1;
+					break;
+
+				case 'g':
+					options.gso = 1;
+					options.batch = 1; // GSO rides on the batched send path
+					break;
+
+				case 'm':
+					options.mmap = 1;
+					break;
+
+				case 'p':
+					options.pace = 1;
+					options.pace_rate = atof(optarg) * 1000000 / 8; // Mbit/s to bytes/s
+					break;
+
+				case 'r':
+					options.rto_min = atof(optarg) * 1000;
+					break;
+
+				case 'R':
+					options.rto_max = atof(optarg) * 1000;
+					break;
+
+				case 't':
+					options.readahead = 1;
+					break;
+
+				case 'w':
+					options.workers = atoi(optarg);
+					if (options.workers <= 0)
+						options.workers = sysconf(_SC_NPROCESSORS_ONLN);
+					if (options.workers <= 0)
+						options.workers = 1;
+					options.events = 1; // Workers run the -e loop
+					break;
+
+				default:
+					printUsage(argv[0]);
+					exit(-1);
+			}
+		}
+
+		if (optind != argc - optionStart + 1)
+		{
+			printUsage(argv[0]);
+			exit(-1);
+		}
+
+		// rtt_init takes the bounds as given, a zero or negative floor or one above the ceiling makes no timeout
+		if ((options.rto_min <= 0) || (options.rto_max < options.rto_min))
+		{
+			printUsage(argv[0]);
+			exit(-1);
 		}
 		
 		return portNumber;
 	}
 
+	void printUsage(char *name)
+	{
+		fprintf(stderr, "Usage %s [error rate] [optional port number] [options]\n", name);
+		fprintf(stderr, "  -b  batch window bursts into one sendmmsg() and ACKs into one recvmmsg()\n");
+		fprintf(stderr, "  -c  congestion control: slow start/AIMD window capped by the negotiated window\n");
+		fprintf(stderr, "  -e  event loop: one process serves every client from the server socket instead of forking per client\n");
+		fprintf(stderr, "  -g  UDP GSO: send runs of full-size PDUs as one UDP_SEGMENT super-datagram (implies -b)\n");
+		fprintf(stderr, "  -m  zero-copy: mmap the file and send DATA as its header plus a pointer into the mapping\n");
+		fprintf(stderr, "  -p Mbps  pace PDUs with a token bucket at this rate (0 follows the measured delivery rate)\n");
+		fprintf(stderr, "  -r ms  retransmission timeout floor (default %d)\n", RTO_MIN_DEFAULT / 1000);
+		fprintf(stderr, "  -R ms  retransmission timeout ceiling (default %d)\n", RTO_MAX_DEFAULT / 1000);
+		fprintf(stderr, "  -t  read-ahead: a thread reads the file in large blocks ahead of the sender\n");
+		fprintf(stderr, "  -w N  N event loop threads (0 for one per core), each on its own SO_REUSEPORT socket (implies -e)\n");
+	}
+
 	void handleZombies(int sig) 
 	{
 		int stat = 0;
@@ -537,8 +1730,21 @@
 	}
 
 
+	// The flow-control window and, with -c, the congestion window both have to have room
+	int send_blocked(struct window* input_window, struct cwnd *cc)
+	{
+		if (window_full(input_window) == 1)
+			return 1;
+
+		if (options.cwnd && !cwnd_allows(cc, input_window->current - input_window->lower))
+			return 1;
+
+		return 0;
+	}
+
+
 	// Function handles timeouts and retransmissions
-	STATE processSelect(struct Connection *connection, int *retryCount, STATE TimeoutState, STATE DataState, STATE DoneState, struct window* input_window, int * finished) {
+	STATE processSelect(struct Connection *connection, int *retryCount, STATE TimeoutState, STATE DataState, STATE DoneState, struct window* input_window, int * finished, struct rtt *rtt, struct cwnd *cc) {
 		int returnValue = DataState;
 		(*retryCount)++;
 		
@@ -549,9 +1755,9 @@
 		else {
 
 			// Window closed
-			if ((window_full(input_window) == 1) || (*finished == 1)) { 
+			if ((send_blocked(input_window, cc) == 1) || (*finished == 1)) { 
 				// printf("Window is full\n");
-				int timer = pollCall(1000); // Wait for 1 second        
+				int timer = pollCallMicro(rtt_timeout(rtt)); // Wait one RTO
 				
 				if (timer != -1) 
 				{
@@ -562,6 +1768,11 @@
 				else if (timer == -1) 
 				{
 					// printf("We timed out\n");
+					rtt_backoff(rtt);
+
+					// Nothing came back for a whole RTO, restart slow start
+					if (options.cwnd)
+						cwnd_timeout(cc, input_window->current - input_window->lower, input_window->current);
 					returnValue = TimeoutState;
 				} 
 				else {
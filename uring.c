@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int ring_enter(struct disk_ring *r, uint32_t wait);
+static void ring_reap(struct disk_ring *r);
+
+// Sets up a ring of up to entries writes of at most buf_len bytes to out_fd, -1 if the kernel can't.
+// No liburing here, the three syscalls and the shared rings are used as they are
+int disk_ring_init(struct disk_ring *r, int out_fd, uint32_t entries, uint32_t buf_len) {
+    struct io_uring_params p;
+    struct iovec pool;
+
+    memset(r, 0, sizeof(struct disk_ring));
+    memset(&p, 0, sizeof(p));
+
+    if (entries > URING_MAX_ENTRIES) {
+        entries = URING_MAX_ENTRIES;
+    }
+    if ((entries == 0) || (buf_len == 0)) {
+        return -1;
+    }
+
+    if ((r->ring_fd = syscall(__NR_io_uring_setup, entries, &p)) < 0) {
+        return -1;
+    }
+
+    r->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    r->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_len > r->sq_ring_len) {
+            r->sq_ring_len = r->cq_ring_len;
+        }
+        r->cq_ring_len = r->sq_ring_len;
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ring = mmap(NULL, r->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+        close(r->ring_fd);
+        return -1;
+    }
+
+    r->cq_ring = r->sq_ring;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        r->cq_ring = mmap(NULL, r->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_CQ_RING);
+    }
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_SQES);
+    if ((r->cq_ring == MAP_FAILED) || (r->sqes == MAP_FAILED)) {
+        close(r->ring_fd); // Set up once per transfer, what did get mapped goes at exit
+        return -1;
+    }
+
+    r->sq_head = (uint32_t *)((uint8_t *)r->sq_ring + p.sq_off.head);
+    r->sq_tail = (uint32_t *)((uint8_t *)r->sq_ring + p.sq_off.tail);
+    r->sq_mask = (uint32_t *)((uint8_t *)r->sq_ring + p.sq_off.ring_mask);
+    r->sq_array = (uint32_t *)((uint8_t *)r->sq_ring + p.sq_off.array);
+    r->cq_head = (uint32_t *)((uint8_t *)r->cq_ring + p.cq_off.head);
+    r->cq_tail = (uint32_t *)((uint8_t *)r->cq_ring + p.cq_off.tail);
+    r->cq_mask = (uint32_t *)((uint8_t *)r->cq_ring + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((uint8_t *)r->cq_ring + p.cq_off.cqes);
+
+    // One buffer per SQ entry, so the SQ can never be full when a buffer is free
+    r->entries = p.sq_entries;
+    r->buf_len = buf_len;
+    r->bufs = (uint8_t *) malloc((size_t)r->entries * buf_len);
+    r->free = (uint32_t *) malloc(r->entries * sizeof(uint32_t));
+    if ((r->bufs == NULL) || (r->free == NULL)) {
+        close(r->ring_fd);
+        return -1;
+    }
+    for (uint32_t i = 0; i < r->entries; i++) {
+        r->free[r->free_count++] = r->entries - 1 - i;
+    }
+
+    // Registered once, the kernel doesn't pin and unpin the pages on every write. Plain writes if it won't
+    pool.iov_base = r->bufs;
+    pool.iov_len = (size_t)r->entries * buf_len;
+    r->fixed = (syscall(__NR_io_uring_register, r->ring_fd, IORING_REGISTER_BUFFERS, &pool, 1) == 0);
+
+    r->out_fd = out_fd;
+    r->active = 1;
+    return 0;
+}
+
+// Copies len bytes and queues their write at offset. Only waits on the disk when every buffer is in flight.
+// -1 once a write has failed
+int disk_ring_write(struct disk_ring *r, uint8_t *data, uint32_t len, off_t offset) {
+    struct io_uring_sqe *sqe = NULL;
+    uint32_t tail = 0;
+    uint32_t index = 0;
+
+    if (r->error != 0) {
+        errno = r->error;
+        return -1;
+    }
+
+    // Larger than a pool buffer (the buffer size was only a guess): everything before it first, then this directly
+    if (len > r->buf_len) {
+        if (disk_ring_drain(r) < 0) {
+            return -1;
+        }
+        ssize_t written = pwrite(r->out_fd, data, len, offset);
+        if (written != (ssize_t)len) {
+            r->error = (written < 0) ? errno : EIO;
+            return -1;
+        }
+        return 0;
+    }
+
+    // Completions already in free a buffer without a syscall, otherwise wait for the disk
+    if (r->free_count == 0) {
+        ring_reap(r);
+    }
+    while (r->free_count == 0) {
+        if (ring_enter(r, 1) < 0) {
+            return -1;
+        }
+        ring_reap(r);
+    }
+
+    index = r->free[--r->free_count];
+    memcpy(r->bufs + (size_t)index * r->buf_len, data, len);
+
+    tail = *r->sq_tail;
+    sqe = &r->sqes[tail & *r->sq_mask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = r->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = r->out_fd;
+    sqe->addr = (uint64_t)(uintptr_t)(r->bufs + (size_t)index * r->buf_len);
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->buf_index = 0; // The pool is a single registered buffer
+    sqe->user_data = ((uint64_t)len << 32) | index; // Length to check the completion against, buffer to give back
+
+    r->sq_array[tail & *r->sq_mask] = tail & *r->sq_mask;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->queued++;
+
+    if (r->queued >= URING_BATCH) {
+        disk_ring_submit(r);
+    }
+
+    return (r->error != 0) ? -1 : 0;
+}
+
+// Hands the queued writes to the kernel and recycles the buffers of those already done (does not block)
+void disk_ring_submit(struct disk_ring *r) {
+    if (r->queued != 0) {
+        ring_enter(r, 0);
+    }
+    ring_reap(r);
+}
+
+// Waits for every write, -1 (errno set) if one failed
+int disk_ring_drain(struct disk_ring *r) {
+    while ((r->queued != 0) || (r->in_flight != 0)) {
+        if (ring_enter(r, 1) < 0) {
+            break;
+        }
+        ring_reap(r);
+    }
+
+    if (r->error != 0) {
+        errno = r->error;
+        return -1;
+    }
+    return 0;
+}
+
+// Submits what is queued, waiting for wait completions. -1 only when the ring itself fails
+static int ring_enter(struct disk_ring *r, uint32_t wait) {
+    int ret = syscall(__NR_io_uring_enter, r->ring_fd, r->queued, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+    if (ret < 0) {
+        // Interrupted, or the kernel wants completions reaped before it takes more
+        if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) {
+            return 0;
+        }
+        if (r->error == 0) {
+            r->error = errno;
+        }
+        return -1;
+    }
+
+    r->queued -= ret;
+    r->in_flight += ret;
+    return 0;
+}
+
+// Takes every completion in, freeing its buffer. A failed or short write is kept as the ring's error
+static void ring_reap(struct disk_ring *r) {
+    uint32_t head = *r->cq_head;
+    uint32_t tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        uint32_t len = cqe->user_data >> 32;
+
+        if ((r->error == 0) && (cqe->res != (int32_t)len)) {
+            r->error = (cqe->res < 0) ? -cqe->res : EIO;
+        }
+
+        r->free[r->free_count++] = cqe->user_data & 0xFFFFFFFF;
+        r->in_flight--;
+        head++;
+    }
+
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
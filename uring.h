@@ -0,0 +1,58 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <linux/io_uring.h>
+
+#define URING_MAX_ENTRIES 256 // Writes in flight at once, each holds one registered buffer
+#define URING_BATCH 32 // Writes queued before they go to the kernel without waiting for the socket to go quiet
+
+// Writes to one file handed to the kernel through io_uring, so the receive loop never waits on the disk.
+// Payloads are copied into a pool of registered buffers, a buffer is free again once its write completes
+struct disk_ring {
+    int active; // Ring is up, writes go through disk_ring_write
+    int ring_fd;
+    int out_fd; // File written
+    int fixed; // Buffers registered with the kernel (IORING_OP_WRITE_FIXED)
+    int error; // errno of the first write that failed, 0 if none
+    uint32_t entries;
+    // Submission queue, shared with the kernel
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    struct io_uring_sqe *sqes;
+    // Completion queue, shared with the kernel
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_len;
+    void *cq_ring; // Same mapping as sq_ring with IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_len;
+    size_t sqes_len;
+    // Buffer pool
+    uint8_t *bufs; // entries * buf_len bytes
+    uint32_t buf_len;
+    uint32_t *free; // Indexes of the buffers not in flight
+    uint32_t free_count;
+    uint32_t queued; // Writes in the SQ the kernel hasn't been told about
+    uint32_t in_flight; // Writes submitted and not completed
+};
+
+// Sets up a ring of up to entries writes of at most buf_len bytes to out_fd, -1 if the kernel can't
+int disk_ring_init(struct disk_ring *r, int out_fd, uint32_t entries, uint32_t buf_len);
+
+// Copies len bytes and queues their write at offset. Only waits on the disk when every buffer is in flight.
+// -1 once a write has failed
+int disk_ring_write(struct disk_ring *r, uint8_t *data, uint32_t len, off_t offset);
+
+// Hands the queued writes to the kernel and recycles the buffers of those already done (does not block)
+void disk_ring_submit(struct disk_ring *r);
+
+// Waits for every write, -1 (errno set) if one failed
+int disk_ring_drain(struct disk_ring *r);
+
+#endif // URING_H
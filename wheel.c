@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "wheel.h"
+
+static void wheel_place(struct wheel *w, struct wheel_timer *t);
+static void wheel_unlink(struct wheel *w, struct wheel_timer *t);
+static void wheel_cascade(struct wheel *w, int level);
+
+// now is the rtt_now() clock every time below is on
+void wheel_init(struct wheel *w, int64_t now) {
+    memset(w, 0, sizeof(struct wheel));
+    w->tick = now / WHEEL_TICK;
+}
+
+void wheel_timer_init(struct wheel_timer *t, void *data) {
+    t->next = NULL;
+    t->prev = NULL;
+    t->expires = 0;
+    t->level = -1;
+    t->data = data;
+}
+
+// Arms t to fire at when, moving it if it was armed already. A time already past fires on the next expiry
+void wheel_arm(struct wheel *w, struct wheel_timer *t, int64_t when) {
+    if (t->level >= 0) {
+        wheel_unlink(w, t);
+    }
+
+    // Rounded up, a timer never fires early
+    t->expires = (when + WHEEL_TICK - 1) / WHEEL_TICK;
+    wheel_place(w, t);
+}
+
+// Disarms t, nothing happens if it wasn't armed
+void wheel_cancel(struct wheel *w, struct wheel_timer *t) {
+    if (t->level >= 0) {
+        wheel_unlink(w, t);
+    }
+}
+
+// One timer due by now, already disarmed. NULL once none is left
+struct wheel_timer *wheel_expired(struct wheel *w, int64_t now) {
+    int64_t target = now / WHEEL_TICK;
+    struct wheel_timer *t = NULL;
+
+    while (1) {
+        if ((t = w->slots[0][w->tick & WHEEL_MASK]) != NULL) {
+            wheel_unlink(w, t);
+            return t;
+        }
+
+        if (w->tick >= target) {
+            return NULL;
+        }
+
+        // With level 0 empty there is nothing to fire before its next turn, skip straight there
+        if (w->count[0] == 0) {
+            w->tick = (w->tick | WHEEL_MASK) + 1;
+            if (w->tick > target) {
+                w->tick = target;
+                continue;
+            }
+        } else {
+            w->tick++;
+        }
+
+        if ((w->tick & WHEEL_MASK) == 0) {
+            wheel_cascade(w, 1);
+        }
+    }
+}
+
+// Earliest time a timer can be due (sleeping until then misses nothing), -1 with no timers armed
+int64_t wheel_next(struct wheel *w) {
+    int64_t next = -1;
+    int64_t turn = 0;
+    int64_t at = 0;
+
+    // Level 0 has a slot per tick, the first one in use is the next expiry
+    if (w->count[0] > 0) {
+        for (int i = 0; i < WHEEL_SLOTS; i++) {
+            if (w->slots[0][(w->tick + i) & WHEEL_MASK] != NULL) {
+                next = w->tick + i;
+                break;
+            }
+        }
+    }
+
+    // Higher up, nothing fires before its slot moves down a level
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        if (w->count[level] == 0) {
+            continue;
+        }
+
+        turn = w->tick >> (WHEEL_BITS * level);
+        for (int i = 1; i <= WHEEL_SLOTS; i++) {
+            if (w->slots[level][(turn + i) & WHEEL_MASK] != NULL) {
+                at = (turn + i) << (WHEEL_BITS * level);
+                if ((next < 0) || (at < next)) {
+                    next = at;
+                }
+                break;
+            }
+        }
+    }
+
+    return (next < 0) ? -1 : next * WHEEL_TICK;
+}
+
+// Onto the level whose span covers how far off t is, in the slot for its expiry
+static void wheel_place(struct wheel *w, struct wheel_timer *t) {
+    int64_t delta = t->expires - w->tick;
+    int level = 0;
+    int slot = 0;
+
+    if (delta < 0) {
+        // Overdue goes on the slot being expired
+        slot = w->tick & WHEEL_MASK;
+    } else if (delta >= ((int64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))) {
+        // Past the top level: the slot it is on now comes round again after a whole turn, then it is placed anew
+        level = WHEEL_LEVELS - 1;
+        slot = (w->tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    } else {
+        while (delta >= ((int64_t)1 << (WHEEL_BITS * (level + 1)))) {
+            level++;
+        }
+        slot = (t->expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    }
+
+    t->level = level;
+    t->prev = &w->slots[level][slot];
+    t->next = w->slots[level][slot];
+    if (t->next != NULL) {
+        t->next->prev = &t->next;
+    }
+    w->slots[level][slot] = t;
+    w->count[level]++;
+}
+
+static void wheel_unlink(struct wheel *w, struct wheel_timer *t) {
+    *t->prev = t->next;
+    if (t->next != NULL) {
+        t->next->prev = t->prev;
+    }
+
+    w->count[t->level]--;
+    t->next = NULL;
+    t->prev = NULL;
+    t->level = -1;
+}
+
+// The level below just started a turn: the slot of this level that turn covers moves down
+static void wheel_cascade(struct wheel *w, int level) {
+    int slot = (w->tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    struct wheel_timer *t = w->slots[level][slot];
+    struct wheel_timer *next = NULL;
+
+    w->slots[level][slot] = NULL;
+    while (t != NULL) {
+        next = t->next;
+        w->count[level]--;
+        wheel_place(w, t);
+        t = next;
+    }
+
+    // A whole turn of this level is done too
+    if ((slot == 0) && (level + 1 < WHEEL_LEVELS)) {
+        wheel_cascade(w, level + 1);
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>
+
+#define WHEEL_TICK 16 // Microseconds per tick, timers fire no earlier and at most this much later than asked
+#define WHEEL_BITS 8
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4 // A slot on each level spans a whole turn of the one below: 4 ms, 1 s, 4.5 min, 19 h
+
+// A timer lives in the caller's struct. While armed it is on one slot's list
+struct wheel_timer {
+    struct wheel_timer *next;
+    struct wheel_timer **prev; // What points at this timer, so it comes off its list without a search
+    int64_t expires; // Tick it fires at
+    int level; // Level it is on, -1 when not armed
+    void *data; // The caller's
+};
+
+// Hierarchical timer wheel (Varghese & Lauck): level 0 holds the timers due within one turn, one slot
+// per tick. Further out they wait on a coarser level, and move down a level each time the level below
+// starts a new turn. Arm, cancel and each expiry are O(1)
+struct wheel {
+    struct wheel_timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    int count[WHEEL_LEVELS]; // Timers on each level
+    int64_t tick; // Next tick to expire, everything before it has fired
+};
+
+// now is the rtt_now() clock every time below is on
+void wheel_init(struct wheel *w, int64_t now);
+
+void wheel_timer_init(struct wheel_timer *t, void *data);
+
+// Arms t to fire at when, moving it if it was armed already. A time already past fires on the next expiry
+void wheel_arm(struct wheel *w, struct wheel_timer *t, int64_t when);
+
+// Disarms t, nothing happens if it wasn't armed
+void wheel_cancel(struct wheel *w, struct wheel_timer *t);
+
+// One timer due by now, already disarmed. NULL once none is left
+struct wheel_timer *wheel_expired(struct wheel *w, int64_t now);
+
+// Earliest time a timer can be due (sleeping until then misses nothing), -1 with no timers armed
+int64_t wheel_next(struct wheel *w);
+
+#endif // WHEEL_H
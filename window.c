@@ -2,34 +2,33 @@
 #include <stdint.h>
 #include <string.h>
 #include "pdu.h"
+#include "window.h"
 #include <stdlib.h>
 
-struct buffer {
-    int seq_num; // Sequence Number
-    int valid; // Valid flag
-    uint8_t packet[1407]; 
-};
-
-struct window {
-    uint32_t upper;
-    uint32_t current;
-    uint32_t lower;
-    int size;
-    struct buffer* window_buffer;
-};
-
-int window_isvalid(struct window* input_window, uint32_t seq_num) {
+int window_isvalid(struct window* input_window, uint64_t seq_num) {
     uint32_t index = (seq_num) % input_window->size;
+
+    if (input_window->bits != NULL) {
+        return (input_window->bits[index / 64] >> (index % 64)) & 1;
+    }
     return input_window->window_buffer[index].valid;
 }
 
 uint8_t* window_get_lower(struct window* input_window) {
     uint32_t index = (input_window->lower) % input_window->size;
+
+    if (input_window->bits != NULL) {
+        return NULL;
+    }
     return input_window->window_buffer[index].packet;
 }
 
-uint8_t* window_get_packet(struct window* input_window, uint32_t seq_num) {
+uint8_t* window_get_packet(struct window* input_window, uint64_t seq_num) {
     uint32_t index = (seq_num) % input_window->size;
+
+    if (input_window->bits != NULL) {
+        return NULL;
+    }
     return input_window->window_buffer[index].packet;
 }
 
@@ -37,23 +36,58 @@ int window_full(struct window* input_window) {
     return (input_window->current == input_window->upper);
 }
 
-// Creates server buffer based off window size input
-void window_create(struct window* input_window, int window_size) {
-    input_window->lower = 1;
-    input_window->current = 1;
+// Creates server buffer based off window size input, every slot holds slot_len bytes. -1 if it can't be allocated
+int window_create(struct window* input_window, int window_size, int slot_len) {
+    if (window_size <= 0) {
+        return -1;
+    }
+
+    input_window->lower = START_SEQ_NUM;
+    input_window->current = START_SEQ_NUM;
     input_window->upper = input_window->current + window_size;
     input_window->size = window_size;
+    input_window->slot_len = slot_len;
     input_window->window_buffer = calloc(window_size, (size_t)sizeof(struct buffer));
+    input_window->packets = calloc(window_size, (size_t)slot_len);
+    input_window->bits = NULL;
     
-    if (input_window->window_buffer== NULL) {
-        printf("Error: Unable to allocate space for buffer.\n");
-        exit(1);
+    if ((input_window->window_buffer== NULL) || (input_window->packets == NULL)) {
+        window_free(input_window);
+        return -1;
     }
 
+    for (int i = 0; i < window_size; i++) {
+        input_window->window_buffer[i].packet = input_window->packets + (size_t)i * slot_len;
+    }
+
+    return 0;
+}
+
+// Creates a window that only marks which PDUs are in, one bit each: the caller already put them where they go.
+// slot_len is still the largest PDU, add/remove/has/isvalid work as usual and find never finds anything. -1 if it can't be allocated
+int window_create_bits(struct window* input_window, int window_size, int slot_len) {
+    if (window_size <= 0) {
+        return -1;
+    }
+
+    input_window->lower = START_SEQ_NUM;
+    input_window->current = START_SEQ_NUM;
+    input_window->upper = input_window->current + window_size;
+    input_window->size = window_size;
+    input_window->slot_len = slot_len;
+    input_window->window_buffer = NULL;
+    input_window->packets = NULL;
+    input_window->bits = calloc((window_size + 63) / 64, sizeof(uint64_t));
+
+    if (input_window->bits == NULL) {
+        return -1;
+    }
+
+    return 0;
 }
 
 // Updates lower and upper to match recent RR
-void window_slide(struct window* input_window, uint32_t rr_num) {
+void window_slide(struct window* input_window, uint64_t rr_num) {
     input_window->lower = rr_num;
     input_window->upper = input_window->lower + input_window->size;
 }
@@ -66,27 +100,74 @@ void window_CURUpdate(struct window* input_window) {
 
 
 // Add packet to window
-void window_add(struct window* input_window, uint32_t seq_num, uint8_t* packet, int32_t packet_len) {
+void window_add(struct window* input_window, uint64_t seq_num, uint8_t* packet, int32_t packet_len) {
     uint32_t index = (seq_num) % input_window->size;
+
+    if (input_window->bits != NULL) {
+        input_window->bits[index / 64] |= (uint64_t)1 << (index % 64);
+        return;
+    }
+
     memcpy(input_window->window_buffer[index].packet, packet, packet_len);
     input_window->window_buffer[index].seq_num = seq_num;
     input_window->window_buffer[index].valid = 1;
+    input_window->window_buffer[index].retransmitted = 0;
+    input_window->window_buffer[index].sent_time = 0;
+    input_window->window_buffer[index].len = packet_len;
+    input_window->window_buffer[index].payload = NULL;
 
     // printPacket(input_window->window_buffer[index].packet, packet_len);
 
 }
 
+// Add a PDU whose payload stays in the source file's mapping: the slot keeps the header and where the payload is
+void window_add_mapped(struct window* input_window, uint64_t seq_num, uint8_t* header, uint8_t* payload, int32_t packet_len) {
+    uint32_t index = (seq_num) % input_window->size;
+    struct buffer *slot = &input_window->window_buffer[index];
+
+    memcpy(slot->packet, header, PDU_HEADER_LEN);
+    slot->seq_num = seq_num;
+    slot->valid = 1;
+    slot->retransmitted = 0;
+    slot->sent_time = 0;
+    slot->len = packet_len;
+    slot->payload = payload;
+}
+
+// Points iov at packet seq_num (header, then the mapped payload if it has one), returns how many iovecs it took
+int window_iov(struct window* input_window, uint64_t seq_num, struct iovec *iov) {
+    uint32_t index = (seq_num) % input_window->size;
+    struct buffer *slot = &input_window->window_buffer[index];
+
+    iov[0].iov_base = slot->packet;
+
+    if (slot->payload == NULL) {
+        iov[0].iov_len = slot->len;
+        return 1;
+    }
+
+    iov[0].iov_len = PDU_HEADER_LEN;
+    iov[1].iov_base = slot->payload;
+    iov[1].iov_len = slot->len - PDU_HEADER_LEN;
+    return 2;
+}
+
 
 // Removes packet after RR
-void window_remove(struct window* input_window, uint32_t seq_num) {
+void window_remove(struct window* input_window, uint64_t seq_num) {
     uint32_t index = (seq_num) % input_window->size;
+
+    if (input_window->bits != NULL) {
+        input_window->bits[index / 64] &= ~((uint64_t)1 << (index % 64));
+        return;
+    }
     input_window->window_buffer[index].valid = 0;
 }
 
 
 // Prints window structure 
 void window_print(struct window* input_window) {
-    printf("\n\nsize: %d, lower: %d, current: %d, upper: %d\n\n", input_window->size, input_window->lower, input_window->current, input_window->upper);
+    printf("\n\nsize: %d, lower: %llu, current: %llu, upper: %llu\n\n", input_window->size, (unsigned long long)input_window->lower, (unsigned long long)input_window->current, (unsigned long long)input_window->upper);
     // printf("\n            ");
     // for (int i = 1; i < 13 ; i++) {
     //     printf("%d       ", i);
@@ -144,5 +225,71 @@ void window_print_test(struct window* input_window, uint32_t data_len, uint32_t
     }
 }
 
+// Records when a packet went out (retransmitted sticks until the slot is reused)
+void window_stamp(struct window* input_window, uint64_t seq_num, int64_t sent_time, int retransmitted) {
+    uint32_t index = (seq_num) % input_window->size;
+    input_window->window_buffer[index].sent_time = sent_time;
+    input_window->window_buffer[index].retransmitted |= retransmitted;
+}
+
+// Send time of a packet that was only sent once, 0 if it can't be used for an RTT sample
+int64_t window_sent_time(struct window* input_window, uint64_t seq_num) {
+    uint32_t index = (seq_num) % input_window->size;
+    struct buffer *slot = &input_window->window_buffer[index];
+
+    if ((slot->seq_num != seq_num) || slot->retransmitted) {
+        return 0;
+    }
+    return slot->sent_time;
+}
+
+// When a packet last went out (retransmissions included), 0 if the slot no longer holds it
+int64_t window_last_sent(struct window* input_window, uint64_t seq_num) {
+    uint32_t index = (seq_num) % input_window->size;
+    struct buffer *slot = &input_window->window_buffer[index];
+
+    if (slot->seq_num != seq_num) {
+        return 0;
+    }
+    return slot->sent_time;
+}
+
+// Checks the slot is valid and holds seq_num (not an older packet sharing the index)
+int window_has(struct window* input_window, uint64_t seq_num) {
+    uint32_t index = (seq_num) % input_window->size;
+
+    // Bits can't tell seq_num from an older PDU on the same index, the caller only asks inside the window
+    if (input_window->bits != NULL) {
+        return window_isvalid(input_window, seq_num);
+    }
+
+    struct buffer *slot = &input_window->window_buffer[index];
+    return slot->valid && (slot->seq_num == seq_num);
+}
 
+// Packet seq_num while its slot still holds it, removed or not (len gets its length), NULL once the slot was reused
+uint8_t* window_find(struct window* input_window, uint64_t seq_num, int32_t *len) {
+    uint32_t index = (seq_num) % input_window->size;
 
+    if (input_window->bits != NULL) {
+        return NULL;
+    }
+
+    struct buffer *slot = &input_window->window_buffer[index];
+    if (slot->seq_num != seq_num) {
+        return NULL;
+    }
+
+    *len = slot->len;
+    return slot->packet;
+}
+
+// Gives back what window_create/window_create_bits allocated
+void window_free(struct window* input_window) {
+    free(input_window->window_buffer);
+    free(input_window->packets);
+    free(input_window->bits);
+    input_window->window_buffer = NULL;
+    input_window->packets = NULL;
+    input_window->bits = NULL;
+}
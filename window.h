@@ -6,49 +6,85 @@
 #include <string.h>
 #include "pdu.h"
 #include <stdlib.h>
+#include <sys/uio.h>
 
 
 struct buffer {
-    int seq_num; // Sequence Number
+    uint64_t seq_num; // Sequence Number
     int valid; // Valid flag
-    uint8_t packet[1407]; 
+    int retransmitted; // Sent more than once (no RTT sample - Karn)
+    int64_t sent_time; // When it was last sent (microseconds)
+    int32_t len; // PDU length
+    uint8_t *packet; // slot_len bytes inside window->packets
+    uint8_t *payload; // Payload left in the source file's mapping (packet only holds the header), NULL when packet is the whole PDU
 };
 
 struct window {
-    uint32_t upper;
-    uint32_t current;
-    uint32_t lower;
+    uint64_t upper;
+    uint64_t current;
+    uint64_t lower;
     int size;
+    int slot_len; // Largest PDU a slot holds (negotiated buffer size + header)
     struct buffer* window_buffer;
+    uint8_t *packets; // size * slot_len bytes backing the slots
+    uint64_t *bits; // window_create_bits: one bit per slot says it is in, nothing else is kept (NULL otherwise)
 };
 
-int window_isvalid(struct window* input_window, uint32_t seq_num);
+int window_isvalid(struct window* input_window, uint64_t seq_num);
 
 // Checks if window is full
 int window_full(struct window* input_window);
 
-// Creates server buffer based off window size input
-void window_create(struct window* input_window, int window_size);
+// Creates server buffer based off window size input, every slot holds slot_len bytes. -1 if it can't be allocated
+int window_create(struct window* input_window, int window_size, int slot_len);
+
+// Creates a window that only marks which PDUs are in, one bit each: the caller already put them where they go.
+// slot_len is still the largest PDU, add/remove/has/isvalid work as usual and find never finds anything. -1 if it can't be allocated
+int window_create_bits(struct window* input_window, int window_size, int slot_len);
 
 // Updates lower and upper to match recent RR
-void window_slide(struct window* input_window, uint32_t rr_num);
+void window_slide(struct window* input_window, uint64_t rr_num);
 
 // Increments current in window
 void window_CURUpdate(struct window* input_window);
 
 // Add packet to window
-void window_add(struct window* input_window, uint32_t seq_num, uint8_t* packet, int32_t packet_len);
+void window_add(struct window* input_window, uint64_t seq_num, uint8_t* packet, int32_t packet_len);
+
+// Add a PDU whose payload stays in the source file's mapping: the slot keeps the header and where the payload is
+void window_add_mapped(struct window* input_window, uint64_t seq_num, uint8_t* header, uint8_t* payload, int32_t packet_len);
+
+// Points iov at packet seq_num (header, then the mapped payload if it has one), returns how many iovecs it took
+int window_iov(struct window* input_window, uint64_t seq_num, struct iovec *iov);
 
 // Removes packet after RR
-void window_remove(struct window* input_window, uint32_t seq_num);
+void window_remove(struct window* input_window, uint64_t seq_num);
 
 // Prints window structure 
 void window_print(struct window* input_window);
 
 uint8_t* window_get_lower(struct window* input_window);
 
-uint8_t* window_get_packet(struct window* input_window, uint32_t seq_num);
+uint8_t* window_get_packet(struct window* input_window, uint64_t seq_num);
 
 void window_print_test(struct window* input_window, uint32_t data_len, uint32_t eof_len, uint32_t eof_seq);
 
+// Records when a packet went out (retransmitted sticks until the slot is reused)
+void window_stamp(struct window* input_window, uint64_t seq_num, int64_t sent_time, int retransmitted);
+
+// Send time of a packet that was only sent once, 0 if it can't be used for an RTT sample
+int64_t window_sent_time(struct window* input_window, uint64_t seq_num);
+
+// When a packet last went out (retransmissions included), 0 if the slot no longer holds it
+int64_t window_last_sent(struct window* input_window, uint64_t seq_num);
+
+// Checks the slot is valid and holds seq_num (not an older packet sharing the index)
+int window_has(struct window* input_window, uint64_t seq_num);
+
+// Packet seq_num while its slot still holds it, removed or not (len gets its length), NULL once the slot was reused
+uint8_t* window_find(struct window* input_window, uint64_t seq_num, int32_t *len);
+
+// Gives back what window_create/window_create_bits allocated
+void window_free(struct window* input_window);
+
 #endif // BUFFER_H